@@ -0,0 +1,516 @@
+#include "LevelJournal.hpp"
+#include "core/FileSync.hpp"
+#include "core/Profiler.hpp"
+#include <algorithm>
+#include <charconv>
+#include <mutex>
+#include <condition_variable>
+
+struct LevelJournal::CheckpointState final {
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool busy = false;
+
+    void wait() {
+        std::unique_lock lock(mutex);
+        condition.wait(lock, [this] { return !busy; });
+    }
+};
+
+struct LevelJournal::BackgroundState final {
+    struct Pending final {
+        std::string name;
+        int revision = 0;
+        std::string levelString;
+        std::string metadata;
+    };
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::optional<Pending> pending;
+    bool running = false;
+};
+
+static constexpr std::string_view CHECKPOINT_MAGIC = "BSCP2";
+// Checkpoints from before the metadata was recorded
+static constexpr std::string_view CHECKPOINT_MAGIC_V1 = "BSCP1";
+static constexpr std::string_view CHECKPOINT_END = "END";
+
+std::string LevelJournalState::toLevelString() const {
+    size_t size = header.size() + 1;
+    for (auto& obj : objects) {
+        size += obj.size() + 1;
+    }
+    std::string res;
+    res.reserve(size);
+    res += header;
+    res += ';';
+    for (auto& obj : objects) {
+        res += obj;
+        res += ';';
+    }
+    return res;
+}
+
+static std::filesystem::path getCheckpointPath(std::filesystem::path const& dir, size_t generation) {
+    return dir / fmt::format("checkpoint-{}", generation);
+}
+static std::filesystem::path getJournalPath(std::filesystem::path const& dir, size_t generation) {
+    return dir / fmt::format("journal-{}", generation);
+}
+// Get N out of `prefix-N`
+static std::optional<size_t> parseGeneration(std::string_view filename, std::string_view prefix) {
+    if (!filename.starts_with(prefix)) {
+        return std::nullopt;
+    }
+    auto num = filename.substr(prefix.size());
+    size_t generation;
+    auto res = std::from_chars(num.data(), num.data() + num.size(), generation);
+    if (res.ec != std::errc() || res.ptr != num.data() + num.size()) {
+        return std::nullopt;
+    }
+    return generation;
+}
+
+// Level names can't really have newlines, but better be safe since the
+// files are line-based
+static std::string sanitizeName(std::string name) {
+    std::replace(name.begin(), name.end(), '\n', ' ');
+    std::replace(name.begin(), name.end(), '\r', ' ');
+    return name;
+}
+
+// The files are line-based, so newlines (and backslashes, to tell them 
+// apart) in the metadata are escaped
+static std::string escapeLine(std::string_view str) {
+    std::string res;
+    res.reserve(str.size());
+    for (auto c : str) {
+        switch (c) {
+            case '\\': res += "\\\\"; break;
+            case '\n': res += "\\n"; break;
+            case '\r': res += "\\r"; break;
+            default: res += c; break;
+        }
+    }
+    return res;
+}
+static std::string unescapeLine(std::string_view str) {
+    std::string res;
+    res.reserve(str.size());
+    for (size_t i = 0; i < str.size(); i += 1) {
+        if (str[i] != '\\' || i + 1 == str.size()) {
+            res += str[i];
+            continue;
+        }
+        i += 1;
+        switch (str[i]) {
+            case 'n': res += '\n'; break;
+            case 'r': res += '\r'; break;
+            default: res += str[i]; break;
+        }
+    }
+    return res;
+}
+
+static void splitLevelString(std::string_view levelString, std::string& header, std::vector<std::string>& objects) {
+    auto headerEnd = levelString.find(';');
+    header = levelString.substr(0, headerEnd);
+    if (headerEnd == std::string_view::npos) {
+        return;
+    }
+    size_t start = headerEnd + 1;
+    while (start < levelString.size()) {
+        auto end = levelString.find(';', start);
+        if (end == std::string_view::npos) {
+            end = levelString.size();
+        }
+        if (end > start) {
+            objects.emplace_back(levelString.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+}
+
+static Result<> writeCheckpoint(
+    std::filesystem::path const& dir, size_t generation,
+    std::string const& name, int revision, std::string const& header,
+    std::string const& metadata, std::vector<std::string> const& objects
+) {
+    auto path = getCheckpointPath(dir, generation);
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            return Err("Unable to open checkpoint file");
+        }
+        file << CHECKPOINT_MAGIC << '\n' << name << '\n' << revision << '\n' << header << '\n';
+        file << escapeLine(metadata) << '\n';
+        for (auto& obj : objects) {
+            file << obj << '\n';
+        }
+        file << CHECKPOINT_END << '\n';
+        if (!file) {
+            return Err("Unable to write checkpoint file");
+        }
+    }
+    if (!syncFile(tmp)) {
+        return Err("Unable to flush checkpoint file to disk");
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        return Err("Unable to commit checkpoint file: {} (code {})", ec.message(), ec.value());
+    }
+    syncDirectory(dir);
+    return Ok();
+}
+
+// Remove the files of every generation before the given one
+static void removeGenerationsBefore(std::filesystem::path const& dir, size_t generation) {
+    for (auto& file : file::readDirectory(dir).unwrapOrDefault()) {
+        auto filename = file.filename().string();
+        auto gen = parseGeneration(filename, "checkpoint-");
+        if (!gen) {
+            gen = parseGeneration(filename, "journal-");
+        }
+        if (gen && *gen < generation) {
+            std::error_code ec;
+            std::filesystem::remove(file, ec);
+        }
+    }
+}
+
+LevelJournal::LevelJournal(std::filesystem::path const& dir, RunInBackground runInBackground, size_t checkpointInterval)
+  : m_dir(dir),
+    m_runInBackground(std::move(runInBackground)),
+    m_checkpointInterval(checkpointInterval),
+    m_checkpoint(std::make_shared<CheckpointState>()),
+    m_background(std::make_unique<BackgroundState>())
+{}
+
+LevelJournal::~LevelJournal() {
+    this->cancelBackground();
+    m_checkpoint->wait();
+}
+
+std::filesystem::path const& LevelJournal::getDirectory() const {
+    return m_dir;
+}
+
+Result<> LevelJournal::startGeneration(std::vector<std::string> objects) {
+    m_checkpoint->wait();
+
+    auto generation = m_hasBase ? m_generation + 1 : 0;
+    // Entries from now on go to the new generation's journal, even if its
+    // checkpoint hasn't been written yet; until it is, recovery just replays
+    // the previous generation's journal first
+    m_journal.close();
+    m_journal.open(getJournalPath(m_dir, generation), std::ios::binary | std::ios::trunc);
+    if (!m_journal) {
+        return Err("Unable to open journal file");
+    }
+    m_generation = generation;
+    m_entriesSinceCheckpoint = 0;
+
+    // The first checkpoint is the only base there is, so it has to be
+    // written right away
+    if (generation == 0) {
+        GEODE_UNWRAP(writeCheckpoint(m_dir, generation, m_name, m_revision, m_header, m_metadata, objects));
+        return Ok();
+    }
+
+    {
+        std::lock_guard lock(m_checkpoint->mutex);
+        m_checkpoint->busy = true;
+    }
+    m_runInBackground([
+        state = m_checkpoint, dir = m_dir, generation,
+        name = m_name, revision = m_revision, header = m_header,
+        metadata = m_metadata, objects = std::move(objects)
+    ] {
+        auto res = writeCheckpoint(dir, generation, name, revision, header, metadata, objects);
+        if (res) {
+            removeGenerationsBefore(dir, generation);
+        }
+        else {
+            log::warn("Unable to write editor checkpoint: {}", res.unwrapErr());
+        }
+        {
+            std::lock_guard lock(state->mutex);
+            state->busy = false;
+        }
+        state->condition.notify_all();
+    });
+    return Ok();
+}
+
+void LevelJournal::cancelBackground() {
+    std::unique_lock lock(m_background->mutex);
+    m_background->pending.reset();
+    m_background->condition.wait(lock, [this] { return !m_background->running; });
+}
+
+Result<size_t> LevelJournal::record(std::string const& name, int revision, std::string_view levelString, std::string metadata) {
+    // Anything still waiting is older than this
+    this->cancelBackground();
+    return this->apply(name, revision, levelString, std::move(metadata));
+}
+
+void LevelJournal::recordInBackground(std::string name, int revision, std::string levelString, std::string metadata) {
+    {
+        std::lock_guard lock(m_background->mutex);
+        m_background->pending = BackgroundState::Pending {
+            std::move(name), revision, std::move(levelString), std::move(metadata)
+        };
+        if (m_background->running) {
+            return;
+        }
+        m_background->running = true;
+    }
+    // The journal waits for this in its destructor, so it outlives the task
+    m_runInBackground([this] {
+        while (true) {
+            BackgroundState::Pending next;
+            {
+                std::lock_guard lock(m_background->mutex);
+                if (!m_background->pending) {
+                    m_background->running = false;
+                    m_background->condition.notify_all();
+                    return;
+                }
+                next = std::move(*m_background->pending);
+                m_background->pending.reset();
+            }
+            auto res = this->apply(next.name, next.revision, next.levelString, std::move(next.metadata));
+            if (!res) {
+                log::error("Unable to autosave level '{}': {}", next.name, res.unwrapErr());
+            }
+        }
+    });
+}
+
+Result<size_t> LevelJournal::apply(std::string const& name, int revision, std::string_view levelString, std::string metadata) {
+    BETTERSAVE_PROFILE("LevelJournal::record");
+    std::string header;
+    std::vector<std::string> objects;
+    splitLevelString(levelString, header, objects);
+
+    std::unordered_map<std::string, size_t> counts;
+    counts.reserve(objects.size());
+    for (auto& obj : objects) {
+        counts[obj] += 1;
+    }
+
+    if (!m_hasBase) {
+        GEODE_UNWRAP(file::createDirectoryAll(m_dir));
+        m_name = sanitizeName(name);
+        m_revision = revision;
+        m_header = std::move(header);
+        m_metadata = std::move(metadata);
+        m_objects = std::move(counts);
+        GEODE_UNWRAP(this->startGeneration(std::move(objects)));
+        m_hasBase = true;
+        return Ok(m_objects.size());
+    }
+
+    std::string entry;
+    size_t entries = 0;
+    auto addLine = [&](char kind, std::string_view value) {
+        entry += kind;
+        entry += value;
+        entry += '\n';
+        entries += 1;
+    };
+    auto sanitized = sanitizeName(name);
+    if (sanitized != m_name) {
+        addLine('N', sanitized);
+    }
+    if (revision != m_revision) {
+        addLine('R', std::to_string(revision));
+    }
+    if (header != m_header) {
+        addLine('H', header);
+    }
+    // Metadata only comes with some records
+    auto metadataChanged = metadata.size() && metadata != m_metadata;
+    if (metadataChanged) {
+        addLine('M', escapeLine(metadata));
+    }
+    for (auto& [obj, count] : counts) {
+        auto old = m_objects.find(obj);
+        for (size_t i = (old != m_objects.end() ? old->second : 0); i < count; i += 1) {
+            addLine('+', obj);
+        }
+    }
+    for (auto& [obj, count] : m_objects) {
+        auto now = counts.find(obj);
+        for (size_t i = (now != counts.end() ? now->second : 0); i < count; i += 1) {
+            addLine('-', obj);
+        }
+    }
+    if (entries == 0) {
+        return Ok(0);
+    }
+    entry += "C\n";
+
+    m_journal.write(entry.data(), entry.size());
+    m_journal.flush();
+    if (!m_journal) {
+        return Err("Unable to write to journal");
+    }
+    if (!syncFile(getJournalPath(m_dir, m_generation))) {
+        return Err("Unable to flush journal to disk");
+    }
+
+    m_name = std::move(sanitized);
+    m_revision = revision;
+    m_header = std::move(header);
+    if (metadataChanged) {
+        m_metadata = std::move(metadata);
+    }
+    m_objects = std::move(counts);
+    m_entriesSinceCheckpoint += 1;
+
+    // Don't let the journal grow forever; if the last checkpoint is still
+    // being written, try again on the next record
+    if (m_entriesSinceCheckpoint >= m_checkpointInterval) {
+        std::unique_lock lock(m_checkpoint->mutex, std::try_to_lock);
+        if (lock.owns_lock() && !m_checkpoint->busy) {
+            lock.unlock();
+            GEODE_UNWRAP(this->startGeneration(std::move(objects)));
+        }
+    }
+    return Ok(entries);
+}
+
+void LevelJournal::discard() {
+    this->cancelBackground();
+    m_checkpoint->wait();
+    m_journal.close();
+    std::error_code ec;
+    std::filesystem::remove_all(m_dir, ec);
+    m_hasBase = false;
+    m_generation = 0;
+    m_entriesSinceCheckpoint = 0;
+    m_metadata.clear();
+    m_objects.clear();
+}
+
+static Result<LevelJournalState> readCheckpoint(std::filesystem::path const& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return Err("Unable to open checkpoint");
+    }
+    LevelJournalState state;
+    std::string line;
+    if (!std::getline(file, line) || (line != CHECKPOINT_MAGIC && line != CHECKPOINT_MAGIC_V1)) {
+        return Err("Not a checkpoint file");
+    }
+    auto hasMetadata = line == CHECKPOINT_MAGIC;
+    std::string revision;
+    if (!std::getline(file, state.name) || !std::getline(file, revision) || !std::getline(file, state.header)) {
+        return Err("Checkpoint is truncated");
+    }
+    state.revision = std::atoi(revision.c_str());
+    if (hasMetadata) {
+        if (!std::getline(file, line)) {
+            return Err("Checkpoint is truncated");
+        }
+        state.metadata = unescapeLine(line);
+    }
+    while (std::getline(file, line)) {
+        if (line == CHECKPOINT_END) {
+            return Ok(std::move(state));
+        }
+        state.objects.push_back(std::move(line));
+    }
+    return Err("Checkpoint is truncated");
+}
+
+Result<LevelJournalState> LevelJournal::replay(std::filesystem::path const& dir) {
+    std::vector<size_t> checkpoints;
+    std::vector<size_t> journals;
+    for (auto& file : file::readDirectory(dir).unwrapOrDefault()) {
+        auto filename = file.filename().string();
+        if (auto gen = parseGeneration(filename, "checkpoint-")) {
+            checkpoints.push_back(*gen);
+        }
+        else if (auto gen = parseGeneration(filename, "journal-")) {
+            journals.push_back(*gen);
+        }
+    }
+    std::sort(checkpoints.rbegin(), checkpoints.rend());
+    std::sort(journals.begin(), journals.end());
+
+    // Use the latest checkpoint that was written completely
+    std::optional<LevelJournalState> base;
+    size_t baseGeneration = 0;
+    for (auto gen : checkpoints) {
+        if (auto res = readCheckpoint(getCheckpointPath(dir, gen))) {
+            base = std::move(res.unwrap());
+            baseGeneration = gen;
+            break;
+        }
+    }
+    if (!base) {
+        return Err("Journal has no usable checkpoint");
+    }
+    auto state = std::move(*base);
+
+    // Objects are replayed as counts, and written back out in their original
+    // order afterwards
+    std::unordered_map<std::string, size_t> counts;
+    std::vector<std::string> order = std::move(state.objects);
+    for (auto& obj : order) {
+        counts[obj] += 1;
+    }
+    for (auto gen : journals) {
+        if (gen < baseGeneration) {
+            continue;
+        }
+        std::ifstream file(getJournalPath(dir, gen), std::ios::binary);
+        std::vector<std::string> pending;
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line != "C") {
+                pending.push_back(std::move(line));
+                continue;
+            }
+            for (auto& op : pending) {
+                if (op.empty()) continue;
+                auto value = std::string_view(op).substr(1);
+                switch (op.front()) {
+                    case 'N': state.name = value; break;
+                    case 'R': state.revision = std::atoi(std::string(value).c_str()); break;
+                    case 'H': state.header = value; break;
+                    case 'M': state.metadata = unescapeLine(value); break;
+                    case '+': {
+                        counts[std::string(value)] += 1;
+                        order.emplace_back(value);
+                    } break;
+                    case '-': {
+                        auto it = counts.find(std::string(value));
+                        if (it != counts.end() && it->second > 0) {
+                            it->second -= 1;
+                        }
+                    } break;
+                    default: break;
+                }
+            }
+            pending.clear();
+        }
+        // Anything left in `pending` is from an entry that was never
+        // committed, so it's dropped
+    }
+
+    for (auto& obj : order) {
+        auto it = counts.find(obj);
+        if (it != counts.end() && it->second > 0) {
+            it->second -= 1;
+            state.objects.push_back(std::move(obj));
+        }
+    }
+    return Ok(std::move(state));
+}
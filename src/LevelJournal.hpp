@@ -0,0 +1,110 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fstream>
+#include <Geode/utils/cocos.hpp>
+
+using namespace geode::prelude;
+
+// The state of a level as recorded by a LevelJournal
+struct LevelJournalState final {
+    std::string name;
+    int revision = 0;
+    // Level settings string (the first part of the level string)
+    std::string header;
+    // The level's plist without its level string, for recreating the level 
+    // with everything else it had (empty if it was never recorded)
+    std::string metadata;
+    std::vector<std::string> objects;
+
+    // The uncompressed level string
+    std::string toLevelString() const;
+};
+
+/**
+ * Append-only journal of the changes made to a level in the editor, for
+ * recovering work after a crash. Each record only writes the objects that
+ * were added or removed since the previous one (a changed object is a removal
+ * and an addition), so its disk cost grows with the size of the edit rather
+ * than the size of the level. Finding those changes still means splitting 
+ * and hashing the whole level string, which grows with the size of the 
+ * level, so autosaves do that on a worker with recordInBackground; only 
+ * building the level string is left to the main thread.
+ *
+ * Every so often a full checkpoint of the level is written in the background
+ * and a new journal generation is started; recovery replays the latest
+ * complete checkpoint plus the journals written after it.
+ *
+ * Files live in their own directory:
+ *  - `checkpoint-N` is the full state at the start of generation N, 
+ *    including the level's metadata
+ *  - `journal-N` holds the entries recorded after that checkpoint; each entry
+ *    ends with a commit line, so a torn write at the end is ignored
+ */
+class LevelJournal final {
+public:
+    // Runs a task off the main thread
+    using RunInBackground = std::function<void(std::function<void()>)>;
+
+protected:
+    struct CheckpointState;
+    struct BackgroundState;
+
+    std::filesystem::path m_dir;
+    RunInBackground m_runInBackground;
+    size_t m_checkpointInterval;
+
+    bool m_hasBase = false;
+    size_t m_generation = 0;
+    size_t m_entriesSinceCheckpoint = 0;
+    std::string m_name;
+    int m_revision = 0;
+    std::string m_header;
+    std::string m_metadata;
+    // Object string -> how many times it appears in the level
+    std::unordered_map<std::string, size_t> m_objects;
+    std::ofstream m_journal;
+    std::shared_ptr<CheckpointState> m_checkpoint;
+    std::unique_ptr<BackgroundState> m_background;
+
+    Result<> startGeneration(std::vector<std::string> objects);
+    Result<size_t> apply(std::string const& name, int revision, std::string_view levelString, std::string metadata);
+    // Drop a background record that hasn't started and wait for the one 
+    // that has
+    void cancelBackground();
+
+public:
+    LevelJournal(std::filesystem::path const& dir, RunInBackground runInBackground, size_t checkpointInterval = 64);
+    ~LevelJournal();
+
+    LevelJournal(LevelJournal const&) = delete;
+    LevelJournal& operator=(LevelJournal const&) = delete;
+
+    std::filesystem::path const& getDirectory() const;
+
+    /**
+     * Record the current state of the level, given its uncompressed level
+     * string and its metadata (see LevelJournalState). The first record 
+     * writes a full checkpoint synchronously; after that only the difference 
+     * is appended. Returns the number of entries written
+     */
+    Result<size_t> record(std::string const& name, int revision, std::string_view levelString, std::string metadata);
+    /**
+     * Record the current state of the level on a worker thread. Records are 
+     * applied in order, and one that hasn't started yet is replaced by a 
+     * newer one, since only the latest state matters. Errors are logged
+     */
+    void recordInBackground(std::string name, int revision, std::string levelString, std::string metadata);
+    // Delete the journal's files, waiting for a checkpoint in progress
+    void discard();
+
+    // Rebuild the last recorded state of a level from a journal directory
+    static Result<LevelJournalState> replay(std::filesystem::path const& dir);
+};
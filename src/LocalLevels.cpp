@@ -1,10 +1,23 @@
 #include "Mod.hpp"
+#include "core/GmdReader.hpp"
+#include "LevelJournal.hpp"
+#include "core/WorkerPool.hpp"
+#include "core/SaveEncoder.hpp"
+#include "TrashQueue.hpp"
 #include <Geode/modify/EditorPauseLayer.hpp>
 #include <Geode/modify/MenuLayer.hpp>
 #include <Geode/modify/GManager.hpp>
+#include <Geode/modify/LevelEditorLayer.hpp>
 #include <Geode/binding/LocalLevelManager.hpp>
 #include <Geode/binding/LevelEditorLayer.hpp>
+#include <Geode/binding/DS_Dictionary.hpp>
+#include <Geode/ui/Notification.hpp>
 #include <hjfod.gmd-api/include/GMD.hpp>
+#include <algorithm>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <fstream>
 
 using namespace geode::prelude;
 
@@ -12,73 +25,451 @@ static std::filesystem::path getTempDir() {
     return dirs::getSaveDir() / "bettersave.temp";
 }
 
-static std::vector<std::string> recoverCrashedLevels() {
-	std::vector<std::string> recovered = {};
+// A level file or journal in the temp directory, read on a worker thread
+struct CrashedLevel final {
+	std::filesystem::path file;
+	std::string name;
+	int revision = 0;
+	// Compressed like GJGameLevel::m_levelString
+	std::string levelString;
+	// Only level files have one; journals just record the level string
+	std::optional<std::string> description;
+	// The plist of the level without its level string, if a journal 
+	// recorded it
+	std::string metadata;
+	bool isJournal = false;
+	// When the file (or the latest file in a journal) was last written
+	std::filesystem::file_time_type modified;
+	std::string error;
+};
+
+// Set while crashed levels are being recovered, during which the temp 
+// directory is left alone (main thread only)
+static bool RECOVERING_CRASHED_LEVELS = false;
+
+// Read everything in the temp directory in parallel. Doesn't touch Cocos
+static std::vector<CrashedLevel> readCrashedLevels() {
+	BETTERSAVE_PROFILE("readCrashedLevels");
+	std::vector<CrashedLevel> crashed;
 	for (auto file : file::readDirectory(getTempDir()).unwrapOrDefault()) {
-		auto levelRes = gmd::importGmdAsLevel(file);
-		if (!levelRes) {
-			log::error("Unable to recover level '{}': {}", file.filename(), levelRes.unwrapErr());
+		// Level files that were never finished being written
+		if (!file.filename().string().starts_with(".")) {
+			crashed.push_back(CrashedLevel { .file = file });
+		}
+	}
+	WorkerPool::get()->parallelFor(crashed.size(), [&](size_t i) {
+		auto& level = crashed[i];
+		std::error_code ec;
+		level.modified = std::filesystem::last_write_time(level.file, ec);
+		// Editor journals
+		if (std::filesystem::is_directory(level.file)) {
+			// Appending to a journal doesn't touch its directory
+			for (auto& file : std::filesystem::directory_iterator(level.file, ec)) {
+				level.modified = std::max(level.modified, file.last_write_time(ec));
+			}
+			auto stateRes = LevelJournal::replay(level.file);
+			if (!stateRes) {
+				level.error = stateRes.unwrapErr();
+				return;
+			}
+			auto state = std::move(stateRes.unwrap());
+			level.name = state.name;
+			level.revision = state.revision;
+			level.levelString = ZipUtils::compressString(state.toLevelString(), false, 0);
+			level.metadata = std::move(state.metadata);
+			level.isJournal = true;
+			return;
+		}
+		auto data = readGmdLevel(level.file);
+		if (!data || !data->meta.isLevel()) {
+			level.error = "Not a level file";
+			return;
+		}
+		level.name = data->meta.name;
+		level.revision = data->meta.revision;
+		level.levelString = std::move(data->levelString);
+		level.description = std::move(data->description);
+	});
+	return crashed;
+}
+
+// Merge what readCrashedLevels read into the local levels
+static std::vector<std::string> mergeCrashedLevels(std::vector<CrashedLevel> const& crashed) {
+	BETTERSAVE_PROFILE("mergeCrashedLevels");
+	std::vector<std::string> recovered = {};
+	auto llm = LocalLevelManager::get();
+	// Look up existing levels by name & revision instead of going through 
+	// all of them for every file
+	std::unordered_map<std::string, GJGameLevel*> existingLevels;
+	auto levelKey = [](std::string const& name, int revision) {
+		return fmt::format("{}\n{}", name, revision);
+	};
+	for (auto level : CCArrayExt<GJGameLevel*>(llm->m_localLevels)) {
+		existingLevels.try_emplace(levelKey(level->m_levelName, level->m_levelRev), level);
+	}
+	// The editor may have been opened before recovery finished, in which 
+	// case whatever is being edited is newer than what crashed
+	auto editor = LevelEditorLayer::get();
+	// New levels are added in one go at the end
+	std::vector<Ref<GJGameLevel>> added;
+	// A level can have both a level file and a journal, so apply them oldest 
+	// first to have the newest one win
+	std::vector<CrashedLevel const*> ordered;
+	for (auto& level : crashed) {
+		ordered.push_back(&level);
+	}
+	std::stable_sort(ordered.begin(), ordered.end(), [](auto a, auto b) {
+		return std::tie(a->revision, a->modified) < std::tie(b->revision, b->modified);
+	});
+	for (auto levelPtr : ordered) {
+		auto& level = *levelPtr;
+		if (level.error.size()) {
+			log::error("Unable to recover level '{}': {}", level.file.filename(), level.error);
 			continue;
 		}
-		auto imported = *levelRes;
-		bool existing = false;
-		// Check if this is an existing level
-		for (auto level : CCArrayExt<GJGameLevel*>(LocalLevelManager::get()->m_localLevels)) {
-			if (level->m_levelName == imported->m_levelName && level->m_levelRev == imported->m_levelRev) {
-				level->m_levelString = imported->m_levelString;
-				level->m_levelDesc = imported->m_levelDesc;
-				existing = true;
-				break;
+		auto existing = existingLevels.find(levelKey(level.name, level.revision));
+		if (existing != existingLevels.end()) {
+			if (editor && editor->m_level == existing->second) {
+				log::warn("Not recovering level '{}' since it's open in the editor", level.name);
+				continue;
+			}
+			existing->second->m_levelString = level.levelString;
+			if (level.description) {
+				existing->second->m_levelDesc = *level.description;
 			}
 		}
-		if (!existing) {
-			LocalLevelManager::get()->m_localLevels->insertObject(imported, 0);
+		else if (level.isJournal) {
+			// Recreate the level with everything but its level string from 
+			// the metadata, if the journal has it
+			Ref<GJGameLevel> created = nullptr;
+			if (level.metadata.size()) {
+				DS_Dictionary dict;
+				if (dict.loadRootSubDictFromString(level.metadata)) {
+					created = GJGameLevel::createWithCoder(&dict);
+				}
+			}
+			if (!created) {
+				created = GJGameLevel::create();
+			}
+			created->m_levelName = level.name;
+			created->m_levelRev = level.revision;
+			created->m_levelType = GJLevelType::Editor;
+			created->m_levelString = level.levelString;
+			added.push_back(created);
+			existingLevels.try_emplace(levelKey(level.name, level.revision), created);
+		}
+		// Level files of levels that don't exist anymore (or never got into 
+		// the local levels) are rare, and have to be imported in full
+		else {
+			auto levelRes = gmd::importGmdAsLevel(level.file);
+			if (!levelRes) {
+				log::error("Unable to recover level '{}': {}", level.file.filename(), levelRes.unwrapErr());
+				continue;
+			}
+			added.push_back(*levelRes);
+			existingLevels.try_emplace(levelKey(level.name, level.revision), *levelRes);
 		}
-		recovered.push_back(imported->m_levelName);
+		recovered.push_back(level.name);
 	}
+	// Newest first, like inserting each at the start would
+	prependObjects(llm->m_localLevels, std::vector<CCObject*>(added.rbegin(), added.rend()));
 
 	// Save LLM
 	if (recovered.size()) {
-		LocalLevelManager::get()->save();
-		std::error_code ec;
-		std::filesystem::remove_all(getTempDir(), ec);
+		llm->save();
+		// Only what was read; the editor may have started new files since
+		for (auto& level : crashed) {
+			std::error_code ec;
+			std::filesystem::remove_all(level.file, ec);
+		}
 	}
 
 	return recovered;
 }
 
-// static bool SKIP_SAVING_LLM = false;
-// class $modify(GManager) {
-// 	$override
-// 	void save() {
-// 		if (static_cast<LocalLevelManager*>(static_cast<GManager*>(this)) == LocalLevelManager::get()) {
-// 			if (SKIP_SAVING_LLM) return;
-// 			GManager::save();
-
-// 			// If saving local levels succeeded, delete temp dir
-// 			std::error_code ec;
-// 			std::filesystem::remove_all(getTempDir(), ec);
-// 		}
-// 		else {
-// 			GManager::save();
-// 		}
-// 	}
-// };
-// struct $modify(EditorPauseLayer) {
-// 	$override
-// 	void saveLevel() {
-// 		SKIP_SAVING_LLM = true;
-// 		EditorPauseLayer::saveLevel();
-// 		SKIP_SAVING_LLM = false;
-
-//     	(void)file::createDirectoryAll(getTempDir());
-// 		auto id = getFreeIDInDir(m_editorLayer->m_level->m_levelName, getTempDir(), "gmd");
-// 		auto save = gmd::exportLevelAsGmd(m_editorLayer->m_level, getTempDir() / id);
-// 		if (!save) {
-// 			log::error("Unable to save level '{}': {}", m_editorLayer->m_level->m_levelName, save.unwrapErr());
-// 		}
-// 	}
-// };
+// What a journal records of a level besides its level string, so a level 
+// that only survived as a journal can be recreated in full. This encodes 
+// the level (without its level string), which is cheap next to building 
+// the level string
+static std::string getJournalMetadata(GJGameLevel* level) {
+	auto snapshot = snapshotLevel(level);
+	return snapshot ? std::move(snapshot->plist) : std::string();
+}
+
+// Journals and level files of levels currently open in the editor (main 
+// thread only)
+static std::unordered_set<std::string> OPEN_TEMP_FILES;
+
+// Set while the editor is saving a level in fast save mode, during which 
+// saving the local levels is deferred
+static bool SKIP_SAVING_LLM = false;
+// Whether the local levels have changes that are only in the temp directory
+static bool LLM_SAVE_PENDING = false;
+
+static void runJournalTask(std::function<void()> task) {
+	WorkerPool::get()->submit(std::move(task));
+}
+
+class $modify(JournalEditorLayer, LevelEditorLayer) {
+	struct Fields {
+		std::unique_ptr<LevelJournal> journal;
+		Ref<GJGameLevel> level;
+		// Where the level is written when saving in fast save mode
+		std::filesystem::path levelFile;
+
+		~Fields() {
+			if (journal) {
+				// Whether the editor was exited with or without saving, what 
+				// should be recovered now is the level as it was last saved
+				std::string levelString = ZipUtils::decompressString(level->m_levelString, false, 0);
+				auto res = journal->record(level->m_levelName, level->m_levelRev, levelString, getJournalMetadata(level));
+				if (!res) {
+					log::error("Unable to record level '{}' on exit: {}", level->m_levelName, res.unwrapErr());
+				}
+				OPEN_TEMP_FILES.erase(journal->getDirectory().string());
+			}
+			if (!levelFile.empty()) {
+				OPEN_TEMP_FILES.erase(levelFile.string());
+			}
+			// Now that the editor is closed, write the local levels that were 
+			// skipped while saving
+			if (LLM_SAVE_PENDING) {
+				Loader::get()->queueInMainThread([] {
+					if (LLM_SAVE_PENDING) {
+						LocalLevelManager::get()->save();
+					}
+				});
+			}
+		}
+	};
+
+	$override
+	bool init(GJGameLevel* level, bool noUI) {
+		if (!LevelEditorLayer::init(level, noUI))
+			return false;
+		
+		m_fields->level = level;
+		auto interval = Mod::get()->getSettingValue<int64_t>("autosave-interval");
+		if (interval > 0) {
+			auto dir = getTempDir() / getFreeIDInDir(level->m_levelName, getTempDir(), "journal");
+			m_fields->journal = std::make_unique<LevelJournal>(dir, &runJournalTask);
+			OPEN_TEMP_FILES.insert(dir.string());
+			this->schedule(schedule_selector(JournalEditorLayer::onAutosave), interval);
+		}
+
+		return true;
+	}
+
+	void recordJournal() {
+		if (!m_fields->journal) return;
+		// Building the level string needs the editor, but diffing it against 
+		// the last record doesn't
+		m_fields->journal->recordInBackground(
+			m_level->m_levelName, m_level->m_levelRev, this->getLevelString(), getJournalMetadata(m_level)
+		);
+	}
+
+	void onAutosave(float) {
+		// Don't autosave while playtesting
+		if (m_playbackMode == PlaybackMode::Playing) return;
+		this->recordJournal();
+	}
+
+	// Durably write just this level to its own file in the temp directory, 
+	// which mergeCrashedLevels merges back into the local levels if the 
+	// game closes before they're saved
+	Result<> writeLevelFile() {
+		BETTERSAVE_PROFILE("JournalEditorLayer::writeLevelFile");
+		auto& path = m_fields->levelFile;
+		if (path.empty()) {
+			(void)file::createDirectoryAll(getTempDir());
+			path = getTempDir() / getFreeIDInDir(m_level->m_levelName, getTempDir(), "gmd");
+			OPEN_TEMP_FILES.insert(path.string());
+		}
+		auto tmp = path.parent_path() / ("." + path.filename().string() + ".tmp");
+		GEODE_UNWRAP_INTO(auto snapshot, snapshotLevel(m_level));
+		GEODE_UNWRAP(writeLevelSnapshot(snapshot, tmp));
+		if (!syncFile(tmp)) {
+			return Err("Unable to flush level file to disk");
+		}
+		std::error_code ec;
+		std::filesystem::rename(tmp, path, ec);
+		if (ec) {
+			return Err("Unable to commit level file: {} (code {})", ec.message(), ec.value());
+		}
+		syncDirectory(getTempDir());
+		return Ok();
+	}
+};
+
+struct $modify(EditorPauseLayer) {
+	$override
+	void saveLevel() {
+		BETTERSAVE_PROFILE("EditorPauseLayer::saveLevel");
+		// In fast save mode, only the edited level is written now and the 
+		// rest of the local levels are written once the editor is closed
+		auto fast = Mod::get()->getSettingValue<bool>("fast-save");
+		SKIP_SAVING_LLM = fast;
+		EditorPauseLayer::saveLevel();
+		SKIP_SAVING_LLM = false;
+
+		auto editor = static_cast<JournalEditorLayer*>(m_editorLayer);
+		if (fast) {
+			auto res = editor->writeLevelFile();
+			if (!res) {
+				log::error("Unable to fast save level '{}', saving all levels: {}", m_editorLayer->m_level->m_levelName, res.unwrapErr());
+				LocalLevelManager::get()->save();
+			}
+			else {
+				LLM_SAVE_PENDING = true;
+			}
+		}
+		// Bring the journal up to date with what was just saved, so a crash 
+		// before the local levels are written doesn't roll the save back
+		editor->recordJournal();
+	}
+};
+// Save the local levels with the parallel encoder instead of GD's own
+static Result<> saveLocalLevelsParallel(GManager* manager) {
+	BETTERSAVE_PROFILE("saveLocalLevelsParallel");
+
+	// Whether GD XORs its save files depends on the platform, so match 
+	// whatever the existing file uses
+	auto path = dirs::getSaveDir() / std::string(manager->m_fileName);
+	uint8_t xorKey = 0;
+	{
+		std::ifstream file(path, std::ios::binary);
+		char magic[4];
+		if (!file.read(magic, sizeof(magic))) {
+			return Err("No existing save file to match");
+		}
+		// Base64 of a gzip header
+		constexpr std::string_view GZIP_BASE64 = "H4sI";
+		if (std::string_view(magic, sizeof(magic)) != GZIP_BASE64) {
+			for (size_t i = 0; i < sizeof(magic); i += 1) {
+				magic[i] ^= 11;
+			}
+			if (std::string_view(magic, sizeof(magic)) != GZIP_BASE64) {
+				return Err("Existing save file is in an unknown format");
+			}
+			xorKey = 11;
+		}
+	}
+
+	DS_Dictionary dict;
+	manager->encodeDataTo(&dict);
+	std::string plist = dict.saveRootSubDictToString();
+	auto encoded = SaveEncoder::get()->encode(plist, xorKey);
+
+	// Make sure GD can actually read the output before trusting it with 
+	// anyone's levels
+	static bool VERIFIED = false;
+	if (!VERIFIED) {
+		std::string decoded = ZipUtils::decompressString(encoded, xorKey != 0, xorKey);
+		if (decoded != plist) {
+			return Err("Encoded save file could not be read back");
+		}
+		VERIFIED = true;
+	}
+
+	auto tmp = path;
+	tmp += ".tmp";
+	GEODE_UNWRAP(file::writeString(tmp, encoded));
+	if (!syncFile(tmp)) {
+		return Err("Unable to flush save file to disk");
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmp, path, ec);
+	if (ec) {
+		return Err("Unable to replace save file: {} (code {})", ec.message(), ec.value());
+	}
+	syncDirectory(path.parent_path());
+	return Ok();
+}
+
+class $modify(LocalLevelsGManager, GManager) {
+	static void onModify(auto& self) {
+		// This may replace GD's save entirely, so run after every other 
+		// mod's hook rather than skip them
+		if (!self.setHookPriority("GManager::save", 3000)) {
+			log::warn("Unable to set the priority of the local levels save hook");
+		}
+	}
+
+	$override
+	void save() {
+		if (static_cast<GManager*>(this) != LocalLevelManager::get()) {
+			return GManager::save();
+		}
+		BETTERSAVE_PROFILE("LocalLevelManager::save");
+		if (SKIP_SAVING_LLM) {
+			LLM_SAVE_PENDING = true;
+			return;
+		}
+		// Never save the local levels without something that was removed 
+		// from them being safely in the trash
+		TrashQueue::get()->flush();
+		if (Mod::get()->getSettingValue<bool>("parallel-save")) {
+			auto res = saveLocalLevelsParallel(this);
+			if (!res) {
+				log::warn("Unable to save local levels in parallel, using the default save: {}", res.unwrapErr());
+				GManager::save();
+			}
+		}
+		else {
+			GManager::save();
+		}
+		LLM_SAVE_PENDING = false;
+
+		// Once the local levels have been saved, journals and level files of 
+		// levels that aren't open anymore have nothing left to recover (unless 
+		// they haven't been recovered yet)
+		if (RECOVERING_CRASHED_LEVELS) {
+			return;
+		}
+		for (auto& file : file::readDirectory(getTempDir()).unwrapOrDefault()) {
+			if (!OPEN_TEMP_FILES.contains(file.string())) {
+				std::error_code ec;
+				std::filesystem::remove_all(file, ec);
+				releaseID(file);
+			}
+		}
+	}
+};
+
+// Read the temp directory off the main thread, so a big recovery doesn't 
+// hold up the title screen, and only merge the results on the main thread
+static void recoverCrashedLevelsInBackground() {
+	RECOVERING_CRASHED_LEVELS = true;
+	Ref<Notification> toast = Notification::create("Recovering levels...", NotificationIcon::Loading, 0);
+	toast->show();
+	WorkerPool::get()->submit([toast = std::move(toast)]() mutable {
+		auto crashed = readCrashedLevels();
+		Loader::get()->queueInMainThread([toast = std::move(toast), crashed = std::move(crashed)] {
+			auto recovered = mergeCrashedLevels(crashed);
+			RECOVERING_CRASHED_LEVELS = false;
+			if (recovered.empty()) {
+				toast->hide();
+				return;
+			}
+			toast->setString(fmt::format("Recovered {} levels", recovered.size()));
+			toast->setIcon(NotificationIcon::Success);
+			toast->waitAndHide();
+
+			auto alert = FLAlertLayer::create(
+				nullptr,
+				"Levels Recovered",
+				fmt::format(
+					"<cy>BetterSave</c> has <cp>recovered data</c> for the following levels after a <cy>crash</c>:\n{}",
+					recovered
+				),
+				"OK", nullptr, 360
+			);
+			showOnMenu(alert);
+		});
+	});
+}
+
 struct $modify(MenuLayer) {
     $override
     bool init() {
@@ -88,19 +479,9 @@ struct $modify(MenuLayer) {
 		static bool ENTERED_MENULAYER_ONCE = false;
 		if (!ENTERED_MENULAYER_ONCE) {
 			ENTERED_MENULAYER_ONCE = true;
-			auto count = recoverCrashedLevels();
-			if (count.size()) {
-				auto alert = FLAlertLayer::create(
-					nullptr,
-					"Levels Recovered",
-					fmt::format(
-						"<cy>BetterSave</c> has <cp>recovered data</c> for the following levels after a <cy>crash</c>:\n{}",
-						count
-					),
-					"OK", nullptr, 360
-				);
-				alert->m_scene = this;
-				alert->show();
+			std::error_code ec;
+			if (!std::filesystem::is_empty(getTempDir(), ec) && !ec) {
+				recoverCrashedLevelsInBackground();
 			}
 		}
         
@@ -1,80 +1,109 @@
 #include "Mod.hpp"
-#include <Geode/utils/general.hpp>
+#include "TrashStorage.hpp"
+#include "core/Filenames.hpp"
+#include "core/GmdWriter.hpp"
+#include <Geode/binding/DS_Dictionary.hpp>
+#include <Geode/utils/file.hpp>
 
 using namespace geode::prelude;
 
-static std::string convertToKebabCase(std::string const& str) {
-	std::string res {};
-	char last = '\0';
-	for (auto c : str) {
-		// Add a dash if the character is in uppercase (camelCase / PascalCase) 
-		// or a space (Normal case) or an underscore (snake_case) and the 
-		// built result string isn't empty and make sure there's only a 
-		// singular dash
-		// Don't add a dash if the previous character was also uppercase or a 
-		// number (SCREAM1NG L33TCASE should be just scream1ng-l33tcase)
-		if ((std::isupper(c) && !(std::isupper(last) || std::isdigit(last))) || std::isspace(c) || c == '_') {
-			if (res.size() && res.back() != '-') {
-				res.push_back('-');
-			}
-		}
-		// Only preserve alphanumeric characters
-		if (std::isalnum(c)) {
-			res.push_back(std::tolower(c));
-		}
-		last = c;
-	}
-	// If there is a dash at the end (for example because the name ended in a 
-	// space) then get rid of that
-	if (res.back() == '-') {
-		res.pop_back();
-	}
-	return res;
-}
-static void checkReservedFilenames(std::string& name) {
-    switch (hash(name.c_str())) {
-        case hash("con"): case hash("prn"): case hash("aux"): case hash("nul"):
-        // This was in https://www.boost.org/doc/libs/1_36_0/libs/filesystem/doc/portability_guide.htm?
-        // Never heard of it before though
-        case hash("clock$"):
-        case hash("com1"): case hash("com2"): case hash("com3"): case hash("com4"):
-        case hash("com5"): case hash("com6"): case hash("com7"): case hash("com8"): case hash("com9"):
-        case hash("lpt1"): case hash("lpt2"): case hash("lpt3"): case hash("lpt4"):
-        case hash("lpt5"): case hash("lpt6"): case hash("lpt7"): case hash("lpt8"): case hash("lpt9"):
-        {
-            name += "-0";
-        }
-        break;
+// Main thread only
+static NameRegistry NAME_REGISTRY;
 
-        default: {} break;
+void reserveID(std::filesystem::path const& path) {
+    NAME_REGISTRY.reserve(path);
+}
+void releaseID(std::filesystem::path const& path) {
+    NAME_REGISTRY.release(path);
+}
+void invalidateIDs(std::filesystem::path const& dir) {
+    NAME_REGISTRY.invalidate(dir);
+}
+std::string getFreeIDInDir(std::string const& name, std::filesystem::path const& dir, std::string const& ext) {
+    auto id = NAME_REGISTRY.getFreeID(name, dir, ext);
+    // Items in the packed trash don't show up when listing the directory
+    while (TrashStorage::get()->isPacked(dir / id)) {
+        NAME_REGISTRY.reserve(dir / id);
+        id = NAME_REGISTRY.getFreeID(name, dir, ext);
     }
+    return id;
 }
 
-std::string getFreeIDInDir(std::string const& orig, std::filesystem::path const& dir, std::string const& ext) {
-    // Synthesize an ID for the level by taking the level name in kebab-case 
-    // and then adding an incrementing number at the end until there exists 
-    // no folder with the same name already
-    auto name = convertToKebabCase(orig);
-    
-    // Prevent names that are too long (some people might use input bypass 
-    // to give levels absurdly long names)
-    if (name.size() > 20) {
-        name = name.substr(0, 20);
+void rebuildArray(CCArray* array, std::vector<CCObject*> const& objects) {
+    // The new contents probably overlap with the old ones, so keep them 
+    // alive while the array is emptied
+    std::vector<Ref<CCObject>> keepAlive(objects.begin(), objects.end());
+    array->removeAllObjects();
+    ccArrayEnsureExtraCapacity(array->data, objects.size());
+    for (auto obj : objects) {
+        ccArrayAppendObject(array->data, obj);
     }
-    if (name.empty()) {
-        name = "unnamed";
+}
+void prependObjects(CCArray* array, std::vector<CCObject*> const& objects) {
+    if (objects.empty()) {
+        return;
     }
+    std::vector<CCObject*> result;
+    result.reserve(objects.size() + array->count());
+    result.insert(result.end(), objects.begin(), objects.end());
+    result.insert(result.end(), array->data->arr, array->data->arr + array->data->num);
+    rebuildArray(array, result);
+}
 
-    // Check that no one has made a level called CON
-    checkReservedFilenames(name);
+// How much of each frame runInSlices may use
+static constexpr auto SLICE_BUDGET = std::chrono::milliseconds(6);
 
-    auto id = name + "." + ext;
-    size_t counter = 0;
+void runInSlices(std::function<bool()> step) {
+    // Queued functions only run on the next frame, so the next slice does too
+    Loader::get()->queueInMainThread([step = std::move(step)]() mutable {
+        auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < SLICE_BUDGET) {
+            if (step()) {
+                return;
+            }
+        }
+        runInSlices(std::move(step));
+    });
+}
+
+// Stands in for the level string while gmd-api exports everything else
+static constexpr std::string_view LEVEL_STRING_PLACEHOLDER = "BetterSaveLevelStringPlaceholder";
 
-    while (std::filesystem::exists(dir / id)) {
-        id = fmt::format("{}-{}", name, counter);
-        counter += 1;
+Result<LevelSnapshot> snapshotLevel(GJGameLevel* level) {
+    BETTERSAVE_PROFILE("snapshotLevel");
+    LevelSnapshot snapshot;
+    if (!level->m_levelString.empty()) {
+        // The level string is left out of the plist and spliced back in when 
+        // the file is written
+        DS_Dictionary dict;
+        level->encodeWithCoder(&dict);
+        dict.setStringForKey("k4", std::string(LEVEL_STRING_PLACEHOLDER));
+        std::string plist = dict.saveRootSubDictToString();
+        if (plist.find(LEVEL_STRING_PLACEHOLDER) != std::string::npos) {
+            snapshot.plist = std::move(plist);
+            snapshot.levelString = std::string_view(level->m_levelString.c_str(), level->m_levelString.size());
+            return Ok(std::move(snapshot));
+        }
+    }
+    // No level string to splice in (or the placeholder didn't make it 
+    // through), so the level goes in the plist whole
+    DS_Dictionary dict;
+    level->encodeWithCoder(&dict);
+    std::string plist = dict.saveRootSubDictToString();
+    if (plist.empty()) {
+        return Err("Unable to encode level");
     }
+    snapshot.plist = std::move(plist);
+    return Ok(std::move(snapshot));
+}
 
-    return id;
+Result<> writeLevelSnapshot(LevelSnapshot const& snapshot, std::filesystem::path const& path) {
+    BETTERSAVE_PROFILE("writeLevelSnapshot");
+    if (!snapshot.levelString) {
+        return file::writeString(path, snapshot.plist);
+    }
+    if (!writeSplicedPlist(path, snapshot.plist, LEVEL_STRING_PLACEHOLDER, *snapshot.levelString)) {
+        return Err("Unable to write level file");
+    }
+    return Ok();
 }
@@ -2,39 +2,153 @@
 
 #include <string>
 #include <filesystem>
+#include <functional>
 #include <Geode/utils/cocos.hpp>
+#include "TrashIndex.hpp"
+#include "core/FileSync.hpp"
+#include "core/Profiler.hpp"
 
 using namespace geode::prelude;
 
-struct UpdateTrashEvent : public Event {};
-
 class Trashed : public CCObject {
 protected:
     std::filesystem::path m_path;
-    std::variant<Ref<GJGameLevel>, Ref<GJLevelList>> m_value;
+    TrashedInfo m_info;
+
+    Trashed(std::filesystem::path const& path, TrashedInfo const& info);
+    static Trashed* create(std::filesystem::path const& path, TrashedInfo const& info);
+
+    static void deliverLoaded(std::vector<Ref<Trashed>> const& items, bool done);
+    static void finishIndexing(std::filesystem::path const& file, std::optional<TrashedInfo> const& info);
 
-    Trashed(std::filesystem::path const& path, GJGameLevel* level);
-    Trashed(std::filesystem::path const& path, GJLevelList* list);
+    friend class TrashRetention;
 
 public:
     using Clock = std::chrono::file_clock;
     using TimePoint = std::chrono::time_point<Clock>;
     using Unit = std::chrono::minutes;
 
+    // Called on the main thread with items as they finish loading; `done` 
+    // is only set on the last call
+    using LoadCallback = std::function<void(std::vector<Ref<Trashed>> const& items, bool done)>;
+
     static std::vector<Ref<Trashed>> load();
+    // Load the trash, indexing any unindexed files on the worker pool. If the 
+    // trash has already been loaded, the callback is called right away
+    static void loadAsync(LoadCallback callback);
+    // Start loading the trash in the background (unless it already is) so 
+    // it's ready by the time the Trashcan is opened
+    static void prefetch(LoadCallback callback = nullptr);
+    static bool isLoading();
+    // Whether the trash is known to be empty. Only reads the cached index, 
+    // so it's cheap to call (but says nothing until the trash has loaded)
+    static bool isEmpty();
+    // Pick up files added to or removed from the trash directory by 
+    // something other than BetterSave
+    static void rescan();
     static Result<> trash(GJGameLevel* level);
     static Result<> trash(GJLevelList* list);
+    // Trash many levels and lists at once. They are encoded in parallel and 
+    // committed to disk together, the local levels and lists are only 
+    // rebuilt once and a single UpdateTrashEvent is posted
+    static Result<> trash(std::vector<GJGameLevel*> const& levels, std::vector<GJLevelList*> const& lists);
     
-    GJGameLevel* asLevel() const;
-    GJLevelList* asList() const;
+    bool isLevel() const;
+    bool isList() const;
+    TrashedInfo const& getInfo() const;
+    // Whether the item's file is still queued to be written
+    bool isPending() const;
+    // Count the level's stats from its level string. Only reads files, so 
+    // it's safe to call from a worker thread, once the item isn't pending
+    Result<LevelStats> countStats() const;
+    // Remember the stats counted from the level's level string, in the 
+    // index too so they never have to be counted again
+    void setStats(LevelStats stats);
+
+    // These import the full file, so only use them when the actual level or 
+    // list is needed
+    Result<Ref<GJGameLevel>> loadLevel() const;
+    Result<Ref<GJLevelList>> loadList() const;
 
     std::string getName() const;
 
     TimePoint getTrashTime() const;
 
     Result<> untrash();
+    // Restore many items at once. The local levels and lists are only 
+    // rebuilt once, with the restored items at the top in the given order
+    static Result<> untrash(std::vector<Ref<Trashed>> const& items);
     Result<> KABOOM();
+    // Permanently delete many items at once, with a single index update and 
+    // UpdateTrashEvent
+    static Result<> KABOOM(std::vector<Ref<Trashed>> const& items);
+    // Permanently delete items without waiting for their files to be 
+    // deleted; they disappear from the trash right away
+    static void purgeInBackground(std::vector<Ref<Trashed>> const& items);
+};
+
+/**
+ * Posted when the contents of the trash change. Changes made during the same 
+ * frame are merged into a single event that is posted on the next frame, so 
+ * use UpdateTrashEvent::queue instead of posting directly
+ */
+struct UpdateTrashEvent : public Event {
+    std::vector<Ref<Trashed>> added;
+    // Filenames of the items that were removed
+    std::vector<std::string> removed;
+    // Whether the whole trash was cleared; `added` lists whatever was added 
+    // after that
+    bool cleared = false;
+    // Whether levels or lists moved between the trash and the local lists
+    bool levelsMoved = false;
+    bool listsMoved = false;
+
+    void merge(UpdateTrashEvent const& other);
+    static void queue(UpdateTrashEvent const& delta);
 };
 
 std::filesystem::path getTrashDir();
+// Import a file from the trash, decompressing it first if needed
+Result<Ref<GJGameLevel>> importTrashedLevel(std::filesystem::path const& path);
+Result<Ref<GJLevelList>> importTrashedList(std::filesystem::path const& path);
+// Everything needed to write a level's .gmd file, without the level itself
+struct LevelSnapshot final {
+    // The level's plist, with a placeholder where the level string goes 
+    // (or the whole file if there's no level string to splice in)
+    std::string plist;
+    // Borrowed from the level, which has to stay alive with its level string 
+    // unchanged until the snapshot has been written
+    std::optional<std::string_view> levelString;
+};
+// Export a level to a .gmd file in two steps: the level is snapshotted on the 
+// main thread, which encodes everything but the level string (a few KB) 
+// through the level's own coder like gmd::exportLevelAsGmd does, and the 
+// snapshot can then be written from any thread with the level string 
+// streamed straight into the file
+Result<LevelSnapshot> snapshotLevel(GJGameLevel* level);
+Result<> writeLevelSnapshot(LevelSnapshot const& snapshot, std::filesystem::path const& path);
+// Find a free filename in a directory for an item with the given name. The 
+// returned ID is marked as taken until released with releaseID. Main thread 
+// only
 std::string getFreeIDInDir(std::string const& name, std::filesystem::path const& dir, std::string const& ext);
+// Mark a path as taken / free for getFreeIDInDir
+void reserveID(std::filesystem::path const& path);
+void releaseID(std::filesystem::path const& path);
+// Forget what getFreeIDInDir knows about a directory, for example after 
+// creating a file in it failed
+void invalidateIDs(std::filesystem::path const& dir);
+
+// Replace the contents of an array in a single pass
+void rebuildArray(CCArray* array, std::vector<CCObject*> const& objects);
+// Insert objects at the start of an array, in order, without shifting the 
+// array for each one like insertObject(obj, 0) would
+void prependObjects(CCArray* array, std::vector<CCObject*> const& objects);
+// Call `step` on the main thread over and over until it returns true, 
+// spreading the calls over as many frames as it takes to only spend a few 
+// milliseconds per frame on them. For main thread work (like importing) that 
+// would freeze the game if done all at once
+void runInSlices(std::function<bool()> step);
+// Show an alert about something that finished in the background on the main 
+// menu, either right away or once the player gets back to it, instead of in 
+// the middle of whatever they're doing (main thread only)
+void showOnMenu(FLAlertLayer* alert);
@@ -0,0 +1,103 @@
+#include "ProfilerPopup.hpp"
+#include <Geode/loader/SettingV3.hpp>
+#include <Geode/loader/Dirs.hpp>
+
+bool ProfilerPopup::setup() {
+    this->setTitle("Profiler");
+
+    m_scrollingLayer = ScrollLayer::create({ 340, 190 });
+    m_mainLayer->addChildAtPosition(m_scrollingLayer, Anchor::Center, -m_scrollingLayer->getContentSize() / 2 + ccp(0, 5));
+
+    auto border = ListBorders::create();
+    border->setContentSize(m_scrollingLayer->getContentSize());
+    m_mainLayer->addChildAtPosition(border, Anchor::Center, ccp(0, 5));
+
+    auto exportSpr = ButtonSprite::create("Export", "goldFont.fnt", "GJ_button_01.png", .7f);
+    auto exportBtn = CCMenuItemSpriteExtra::create(
+        exportSpr, this, menu_selector(ProfilerPopup::onExport)
+    );
+    m_buttonMenu->addChildAtPosition(exportBtn, Anchor::Bottom, ccp(-45, 22));
+
+    auto clearSpr = ButtonSprite::create("Clear", "goldFont.fnt", "GJ_button_06.png", .7f);
+    auto clearBtn = CCMenuItemSpriteExtra::create(
+        clearSpr, this, menu_selector(ProfilerPopup::onClear)
+    );
+    m_buttonMenu->addChildAtPosition(clearBtn, Anchor::Bottom, ccp(45, 22));
+
+    this->updateList();
+
+    return true;
+}
+
+void ProfilerPopup::updateList() {
+    auto content = m_scrollingLayer->m_contentLayer;
+    content->removeAllChildren();
+
+    std::vector<std::string> lines;
+    for (auto& summary : Profiler::get()->summarize()) {
+        lines.push_back(fmt::format(
+            "{}: {}x, total {:.2f}ms, mean {:.2f}ms, p90 {:.2f}ms, max {:.2f}ms",
+            summary.name, summary.count, summary.totalMs, summary.meanMs, summary.p90Ms, summary.maxMs
+        ));
+    }
+    if (lines.empty()) {
+        lines.push_back("Nothing has been recorded yet");
+    }
+
+    constexpr float LINE_HEIGHT = 14.f;
+    auto size = m_scrollingLayer->getContentSize();
+    auto height = std::max(size.height, lines.size() * LINE_HEIGHT + 10);
+    content->setContentHeight(height);
+    float y = height - 5 - LINE_HEIGHT / 2;
+    for (auto& line : lines) {
+        auto label = CCLabelBMFont::create(line.c_str(), "chatFont.fnt");
+        label->limitLabelWidth(size.width - 10, .5f, .1f);
+        label->setAnchorPoint({ 0, .5f });
+        label->setPosition(5, y);
+        content->addChild(label);
+        y -= LINE_HEIGHT;
+    }
+    m_scrollingLayer->scrollToTop();
+}
+
+void ProfilerPopup::onExport(CCObject*) {
+    auto path = dirs::getSaveDir() / "bettersave-trace.json";
+    auto res = file::writeString(path, Profiler::get()->toChromeTrace());
+    if (!res) {
+        FLAlertLayer::create(
+            "Error Exporting Trace",
+            fmt::format("Unable to write trace: {}", res.unwrapErr()),
+            "OK"
+        )->show();
+        return;
+    }
+    FLAlertLayer::create(
+        "Trace Exported",
+        fmt::format(
+            "The trace has been saved to <cy>{}</c>. Open it in <cp>Perfetto</c> or <cp>chrome://tracing</c> to view it.",
+            path.filename().string()
+        ),
+        "OK"
+    )->show();
+}
+void ProfilerPopup::onClear(CCObject*) {
+    Profiler::get()->clear();
+    this->updateList();
+}
+
+ProfilerPopup* ProfilerPopup::create() {
+    auto ret = new ProfilerPopup();
+    if (ret && ret->initAnchored(380, 260)) {
+        ret->autorelease();
+        return ret;
+    }
+    CC_SAFE_DELETE(ret);
+    return nullptr;
+}
+
+$execute {
+    Profiler::get()->setEnabled(Mod::get()->getSettingValue<bool>("enable-profiling"));
+    listenForSettingChanges("enable-profiling", [](bool enabled) {
+        Profiler::get()->setEnabled(enabled);
+    });
+}
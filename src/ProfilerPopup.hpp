@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Mod.hpp"
+#include <Geode/ui/Popup.hpp>
+
+using namespace geode::prelude;
+
+// Shows the timings recorded by the Profiler, for debugging slow saves
+class ProfilerPopup : public Popup<> {
+protected:
+    ScrollLayer* m_scrollingLayer;
+
+    bool setup() override;
+    void updateList();
+
+    void onExport(CCObject* sender);
+    void onClear(CCObject* sender);
+
+public:
+    static ProfilerPopup* create();
+};
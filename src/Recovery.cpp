@@ -1,6 +1,10 @@
 #include "Mod.hpp"
+#include "core/Dedup.hpp"
+#include "core/GmdReader.hpp"
+#include "core/WorkerPool.hpp"
 #include <Geode/DefaultInclude.hpp>
 #include <Geode/modify/MenuLayer.hpp>
+#include <Geode/ui/Notification.hpp>
 #include <hjfod.gmd-api/include/GMD.hpp>
 
 using namespace geode::prelude;
@@ -18,6 +22,26 @@ struct RecoveryStats final {
     size_t trashedFailed = 0;
 };
 
+static std::string_view getLevelContent(GJGameLevel* const& level) {
+    return std::string_view(level->m_levelString.c_str(), level->m_levelString.size());
+}
+static std::string_view getListContent(GJLevelList* const& list) {
+    return std::string_view(
+        reinterpret_cast<const char*>(list->m_levels.data()),
+        list->m_levels.size() * sizeof(int)
+    );
+}
+
+template <class T>
+static ContentIndex<T*> createContentIndex(CCArray* existing, std::string_view(*contentOf)(T* const&)) {
+    ContentIndex<T*> index(contentOf);
+    index.reserve(existing->count());
+    for (auto item : CCArrayExt<T*>(existing)) {
+        index.add(item);
+    }
+    return index;
+}
+
 static std::vector<std::string> recoverLevelOrder(std::filesystem::path const& file, std::string const& key) {
 	// Try to load metadata, but don't hard-fail if not possible
 	auto metaRes = file::readFromJson<matjson::Value>(file);
@@ -27,113 +51,268 @@ static std::vector<std::string> recoverLevelOrder(std::filesystem::path const& f
     return matjson::Serialize<std::vector<std::string>>::from_json(metaRes->as_object()[key]);
 }
 
-static RecoveryStats recoverOldBS() {
-	auto oldSaveDir = dirs::getSaveDir() / "levels";
+// Order items by where their ID appears in the old metadata's order
+static std::vector<CCObject*> orderByID(std::vector<CCObject*> const& items, std::vector<std::string> const& order) {
+    std::vector<std::string> ids;
+    ids.reserve(items.size());
+    for (auto item : items) {
+        ids.push_back(static_cast<CCNode*>(item)->getID());
+    }
+    std::vector<CCObject*> result;
+    result.reserve(items.size());
+    for (auto i : orderByRank(ids, order)) {
+        result.push_back(items[i]);
+    }
+    return result;
+}
 
-    RecoveryStats stats;
-    auto llm = LocalLevelManager::get();
+// Everything in the old save directory, read on a worker thread
+struct OldSaveScan final {
+    std::vector<std::filesystem::path> levels;
+    // Level strings of `levels` for finding duplicates, or nullopt for files 
+    // that could only be read by importing them
+    std::vector<std::optional<std::string>> levelStrings;
+    std::vector<std::string> levelNames;
+    std::vector<std::filesystem::path> lists;
+    std::vector<std::string> levelOrder;
+    std::vector<std::string> listOrder;
+};
+
+// Find the old levels and lists, and move the old trashcan into the trash. 
+// Doesn't touch Cocos
+static OldSaveScan scanOldBS(RecoveryStats& stats) {
+	BETTERSAVE_PROFILE("scanOldBS");
+	auto oldSaveDir = dirs::getSaveDir() / "levels";
+    OldSaveScan scan;
 
-	log::info("Recovering lost levels...");
 	for (auto dir : file::readDirectory(oldSaveDir / "created").unwrapOrDefault()) {
 		if (std::filesystem::exists(dir / "level.gmd")) {
-			auto levelRes = gmd::importGmdAsLevel(dir / "level.gmd");
-			if (!levelRes) {
-                stats.failedLevels += 1;
-				log::error("Unable to recover level '{}': {}", dir.filename(), levelRes.unwrapErr());
-                continue;
-			}
-            auto level = *levelRes;
-            for (auto existing : CCArrayExt<GJGameLevel*>(llm->m_localLevels)) {
-                if (existing->m_levelString == level->m_levelString) {
-                    stats.duplicateLevels += 1;
-				    log::warn("Skipping duplicate level '{}' (duplicate of '{}')", level->m_levelName, existing->m_levelName);
-                    goto continue_outer_level_loop;
-                }
-            }
-            level->setID(dir.filename().string());
-            llm->m_localLevels->insertObject(level, 0);
-            stats.recoveredLevels += 1;
-		}
-        continue_outer_level_loop:;
-	}
-
-    auto levelsOrder = recoverLevelOrder(oldSaveDir / "created" / "metadata.json", "level-order");
-	auto levels = llm->m_localLevels->data;
-	std::sort(
-		levels->arr, levels->arr + levels->num,
-		[&levelsOrder](CCObject* first, CCObject* second) -> bool {
-			return ranges::indexOf(levelsOrder, static_cast<GJGameLevel*>(first)->getID()) < 
-				ranges::indexOf(levelsOrder, static_cast<GJGameLevel*>(second)->getID());
-		}
-	);
-
-	log::info("Recovered {} levels ({} duplicates, {} failed)", stats.recoveredLevels, stats.duplicateLevels, stats.failedLevels);
+            scan.levels.push_back(dir / "level.gmd");
+        }
+    }
+    scan.levelStrings.resize(scan.levels.size());
+    scan.levelNames.resize(scan.levels.size());
+    WorkerPool::get()->parallelFor(scan.levels.size(), [&](size_t i) {
+        if (auto data = readGmdLevel(scan.levels[i])) {
+            scan.levelStrings[i] = std::move(data->levelString);
+            scan.levelNames[i] = std::move(data->meta.name);
+        }
+    });
+    scan.levelOrder = recoverLevelOrder(oldSaveDir / "created" / "metadata.json", "level-order");
 
-	log::info("Recovering lost lists...");
 	for (auto dir : file::readDirectory(oldSaveDir / "lists").unwrapOrDefault()) {
 		if (std::filesystem::exists(dir / "list.gmdl")) {
-			auto listRes = gmd::importGmdAsList(dir / "list.gmdl");
-			if (!listRes) {
-                stats.failedLists += 1;
-				log::error("Unable to recover list '{}': {}", dir.filename(), listRes.unwrapErr());
-                continue;
-			}
-            auto list = *listRes;
-            for (auto existing : CCArrayExt<GJLevelList*>(llm->m_localLists)) {
-                if (std::vector<int>(existing->m_levels) == std::vector<int>(list->m_levels)) {
-                    stats.duplicateLists += 1;
-				    log::warn("Skipping duplicate list '{}' (duplicate of '{}')", list->m_listName, existing->m_listName);
-                    goto continue_outer_list_loop;
-                }
-            }
-            llm->m_localLists->insertObject(list, 0);
-            stats.recoveredLists += 1;
-		}
-        continue_outer_list_loop:;
-	}
-
-    auto listsOrder = recoverLevelOrder(oldSaveDir / "lists" / "metadata.json", "list-order");
-	auto lists = llm->m_localLists->data;
-	std::sort(
-		lists->arr, lists->arr + lists->num,
-		[&listsOrder](CCObject* first, CCObject* second) -> bool {
-			return ranges::indexOf(listsOrder, static_cast<GJLevelList*>(first)->getID()) < 
-				ranges::indexOf(listsOrder, static_cast<GJLevelList*>(second)->getID());
-		}
-	);
-
-	log::info("Recovered {} lists ({} duplicates, {} failed)", stats.recoveredLists, stats.duplicateLists, stats.failedLists);
+            scan.lists.push_back(dir / "list.gmdl");
+        }
+    }
+    scan.listOrder = recoverLevelOrder(oldSaveDir / "lists" / "metadata.json", "list-order");
 
 	log::info("Recovering trashcan...");
 	for (auto dir : file::readDirectory(oldSaveDir / "trashcan").unwrapOrDefault()) {
         std::error_code ec;
+        std::filesystem::path moved;
 		if (std::filesystem::exists(dir / "level.gmd")) {
-            std::filesystem::rename(dir / "level.gmd", getTrashDir() / (dir.filename().string() + ".gmd"), ec);
-            if (!ec) {
-                stats.trashedItems += 1;
-            }
-            else {
-                stats.trashedFailed += 1;
-            }
+            moved = getTrashDir() / (dir.filename().string() + ".gmd");
+            std::filesystem::rename(dir / "level.gmd", moved, ec);
 		}
 		else if (std::filesystem::exists(dir / "list.gmdl")) {
-            std::filesystem::rename(dir / "list.gmdl", getTrashDir() / (dir.filename().string() + ".gmdl"), ec);
-            if (!ec) {
-                stats.trashedItems += 1;
-            }
-            else {
-                stats.trashedFailed += 1;
-            }
+            moved = getTrashDir() / (dir.filename().string() + ".gmdl");
+            std::filesystem::rename(dir / "list.gmdl", moved, ec);
 		}
+        if (!moved.empty() && !ec) {
+            stats.trashedItems += 1;
+        }
         else {
             stats.trashedFailed += 1;
         }
     }
 	log::info("Recovered {} trashcan items ({} failed)", stats.trashedItems, stats.trashedFailed);
 
-    (void)file::writeString(oldSaveDir / ".recovered-by-new-bettersave", "");
+    return scan;
+}
 
-    return stats;
+// Where merging a scan into the local levels is at, across frames
+struct OldSaveMerge final {
+    OldSaveScan scan;
+    RecoveryStats stats;
+    // Indices of the levels in `scan` that aren't duplicates
+    std::vector<size_t> toImport;
+    size_t imported = 0;
+    std::vector<Ref<GJGameLevel>> recoveredLevels;
+    Ref<Notification> toast;
+};
+
+// Skip levels that are already in the local levels (or were recovered 
+// already), going by the level strings read in the background
+static void findDuplicateLevels(OldSaveMerge& merge) {
+	BETTERSAVE_PROFILE("findDuplicateLevels");
+    struct Content final {
+        std::string_view levelString;
+        std::string name;
+    };
+    ContentIndex<Content> index([](Content const& c) { return c.levelString; });
+    auto llm = LocalLevelManager::get();
+    index.reserve(llm->m_localLevels->count() + merge.scan.levels.size());
+    for (auto level : CCArrayExt<GJGameLevel*>(llm->m_localLevels)) {
+        index.add(Content { getLevelContent(level), level->m_levelName });
+    }
+    for (size_t i = 0; i < merge.scan.levels.size(); i += 1) {
+        auto& levelString = merge.scan.levelStrings[i];
+        if (!levelString) {
+            merge.toImport.push_back(i);
+            continue;
+        }
+        auto content = Content { *levelString, merge.scan.levelNames[i] };
+        if (auto existing = index.findDuplicate(content)) {
+            merge.stats.duplicateLevels += 1;
+            log::warn("Skipping duplicate level '{}' (duplicate of '{}')", content.name, existing->name);
+            continue;
+        }
+        index.add(content);
+        merge.toImport.push_back(i);
+    }
+}
+
+// Import one of the levels that aren't duplicates. Returns true once all of 
+// them have been imported
+static bool importNextLevel(OldSaveMerge& merge) {
+    if (merge.imported >= merge.toImport.size()) {
+        return true;
+    }
+    auto& path = merge.scan.levels[merge.toImport[merge.imported]];
+    merge.imported += 1;
+    auto levelRes = gmd::importGmdAsLevel(path);
+    if (!levelRes) {
+        merge.stats.failedLevels += 1;
+        log::error("Unable to recover level '{}': {}", path.parent_path().filename(), levelRes.unwrapErr());
+        return false;
+    }
+    auto level = *levelRes;
+    level->setID(path.parent_path().filename().string());
+    merge.recoveredLevels.push_back(level);
+    merge.stats.recoveredLevels += 1;
+    return false;
+}
+
+// Lists are tiny, so these are all imported at once
+static void recoverLists(OldSaveMerge& merge) {
+	BETTERSAVE_PROFILE("recoverLists");
+    auto llm = LocalLevelManager::get();
+	log::info("Recovering lost lists...");
+    auto listIndex = createContentIndex<GJLevelList>(llm->m_localLists, &getListContent);
+    std::vector<Ref<GJLevelList>> recoveredLists;
+	for (auto& path : merge.scan.lists) {
+        auto listRes = gmd::importGmdAsList(path);
+        if (!listRes) {
+            merge.stats.failedLists += 1;
+            log::error("Unable to recover list '{}': {}", path.parent_path().filename(), listRes.unwrapErr());
+            continue;
+        }
+        auto list = *listRes;
+        if (auto existing = listIndex.findDuplicate(list)) {
+            merge.stats.duplicateLists += 1;
+            log::warn("Skipping duplicate list '{}' (duplicate of '{}')", list->m_listName, (*existing)->m_listName);
+            continue;
+        }
+        recoveredLists.push_back(list);
+        listIndex.add(list);
+        merge.stats.recoveredLists += 1;
+	}
+
+    std::vector<CCObject*> lists(recoveredLists.rbegin(), recoveredLists.rend());
+    lists.insert(lists.end(), llm->m_localLists->data->arr, llm->m_localLists->data->arr + llm->m_localLists->data->num);
+    rebuildArray(llm->m_localLists, orderByID(lists, merge.scan.listOrder));
+
+	log::info("Recovered {} lists ({} duplicates, {} failed)", merge.stats.recoveredLists, merge.stats.duplicateLists, merge.stats.failedLists);
+}
+
+static void finishRecovery(OldSaveMerge& merge) {
+    auto llm = LocalLevelManager::get();
+    // Recovered levels go in front of the existing ones, newest first (like 
+    // inserting each at the start would)
+    std::vector<CCObject*> levels(merge.recoveredLevels.rbegin(), merge.recoveredLevels.rend());
+    levels.insert(levels.end(), llm->m_localLevels->data->arr, llm->m_localLevels->data->arr + llm->m_localLevels->data->num);
+    rebuildArray(llm->m_localLevels, orderByID(levels, merge.scan.levelOrder));
+
+	log::info("Recovered {} levels ({} duplicates, {} failed)", merge.stats.recoveredLevels, merge.stats.duplicateLevels, merge.stats.failedLevels);
+
+    recoverLists(merge);
+
+    // Index the old trashcan (in the background, unless the trash hasn't 
+    // been loaded yet, in which case loading it will)
+    Trashed::rescan();
+
+    (void)file::writeString(dirs::getSaveDir() / "levels" / ".recovered-by-new-bettersave", "");
+
+    auto& stats = merge.stats;
+    merge.toast->setString("Levels recovered");
+    merge.toast->setIcon(NotificationIcon::Success);
+    merge.toast->waitAndHide();
+    auto alert = FLAlertLayer::create(
+        nullptr,
+        "Levels Recovered",
+        fmt::format(
+            "<cy>BetterSave</c> has <cp>recovered</c> the following lost levels:\n"
+            "<cg>{}</c> levels (<cr>{}</c> duplicates skipped, <cr>{}</c> failed to recover)\n"
+            "<cj>{}</c> lists (<cr>{}</c> duplicates skipped, <cr>{}</c> failed to recover)\n"
+            "<co>{}</c> trashcan items (<cr>{}</c> failed to recover)",
+            stats.recoveredLevels, stats.duplicateLevels, stats.failedLevels,
+            stats.recoveredLists, stats.duplicateLists, stats.failedLists,
+            stats.trashedItems, stats.trashedFailed
+        ),
+        "OK", nullptr, 360
+    );
+    showOnMenu(alert);
+}
+
+// Reading the old save directory happens in the background, and importing 
+// what's in it is spread over frames, so the title screen stays responsive 
+// no matter how much there is to recover
+static void recoverOldBSInBackground() {
+    static bool RUNNING = false;
+    if (RUNNING) {
+        return;
+    }
+    RUNNING = true;
+	log::info("Recovering lost levels...");
+    Ref<Notification> toast = Notification::create("Recovering levels...", NotificationIcon::Loading, 0);
+    toast->show();
+    WorkerPool::get()->submit([toast = std::move(toast)]() mutable {
+        auto merge = std::make_shared<OldSaveMerge>();
+        merge->scan = scanOldBS(merge->stats);
+        Loader::get()->queueInMainThread([merge, toast = std::move(toast)]() mutable {
+            merge->toast = std::move(toast);
+            findDuplicateLevels(*merge);
+            runInSlices([merge] {
+                if (!importNextLevel(*merge)) {
+                    merge->toast->setString(fmt::format(
+                        "Recovering levels ({}/{})...", merge->imported, merge->toImport.size()
+                    ));
+                    return false;
+                }
+                finishRecovery(*merge);
+                RUNNING = false;
+                return true;
+            });
+        });
+    });
+}
+
+// Alerts waiting for the player to get back to the main menu
+static std::vector<Ref<FLAlertLayer>>& getPendingAlerts() {
+    static auto alerts = new std::vector<Ref<FLAlertLayer>>();
+    return *alerts;
+}
+
+void showOnMenu(FLAlertLayer* alert) {
+    auto scene = CCDirector::get()->getRunningScene();
+    if (auto menu = scene ? scene->getChildByType<MenuLayer>(0) : nullptr) {
+        alert->m_scene = menu;
+        alert->show();
+    }
+    else {
+        getPendingAlerts().push_back(alert);
+    }
 }
 
 struct $modify(MenuLayer) {
@@ -147,24 +326,14 @@ struct $modify(MenuLayer) {
             std::filesystem::exists(oldSaveDir) &&
             !std::filesystem::exists(oldSaveDir / ".recovered-by-new-bettersave")
         ) {
-            auto stats = recoverOldBS();
-            auto alert = FLAlertLayer::create(
-                nullptr,
-                "Levels Recovered",
-                fmt::format(
-                    "<cy>BetterSave</c> has <cp>recovered</c> the following lost levels:\n"
-                    "<cg>{}</c> levels (<cr>{}</c> duplicates skipped, <cr>{}</c> failed to recover)\n"
-                    "<cj>{}</c> lists (<cr>{}</c> duplicates skipped, <cr>{}</c> failed to recover)\n"
-                    "<co>{}</c> trashcan items (<cr>{}</c> failed to recover)",
-                    stats.recoveredLevels, stats.duplicateLevels, stats.failedLevels,
-                    stats.recoveredLists, stats.duplicateLists, stats.failedLists,
-                    stats.trashedItems, stats.trashedFailed
-                ),
-                "OK", nullptr, 360
-            );
+            recoverOldBSInBackground();
+        }
+
+        for (auto& alert : getPendingAlerts()) {
             alert->m_scene = this;
             alert->show();
         }
+        getPendingAlerts().clear();
 
         return true;
     }
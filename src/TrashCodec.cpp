@@ -0,0 +1,277 @@
+#include "TrashCodec.hpp"
+#include "core/GmdReader.hpp"
+#include "core/LevelStats.hpp"
+#include <Geode/utils/file.hpp>
+#include <zstd.h>
+#include <fstream>
+
+using namespace geode::prelude;
+
+static constexpr int COMPRESSION_LEVEL = 9;
+
+// Raw content dictionary for zstd. Made up of the plist skeleton GD writes
+// for levels & lists, the start of a typical level string and common object
+// property runs. zstd favors matches near the end of the dictionary, so the
+// most common content goes last
+static constexpr std::string_view TRASH_DICTIONARY =
+    R"(<?xml version="1.0"?><plist version="1.0" gjver="2.0"><dict><k>kCEK</k><i>4</i>)"
+    R"(<k>k2</k><s></s><k>k3</k><s></s><k>k4</k><s></s><k>k5</k><s></s><k>k13</k><t /><k>k21</k><i>2</i>)"
+    R"(<k>k16</k><i>1</i><k>k80</k><i></i><k>k81</k><i></i><k>k50</k><i>45</i><k>k47</k><t /><k>k48</k><i></i>)"
+    R"(<k>k23</k><i></i><k>k46</k><i></i><k>k45</k><i></i><k>k8</k><i></i><k>k104</k><s></s><k>k105</k><s></s>)"
+    R"(<k>kI1</k><r></r><k>kI2</k><r></r><k>kI3</k><r>1</r><k>kI6</k><d><k>0</k><s>0</s><k>1</k><s>0</s></d></dict></plist>)"
+    "kS38,1_0_2_102_3_255_11_255_12_255_13_255_4_-1_6_1000_7_1_15_1_18_0_8_1|"
+    "1_0_2_102_3_255_11_255_12_255_13_255_4_-1_6_1001_7_1_15_1_18_0_8_1|"
+    "1_40_2_125_3_255_11_255_12_255_13_255_4_-1_6_1009_7_1_15_1_18_0_8_1|"
+    "1_255_2_255_3_255_11_255_12_255_13_255_4_-1_6_1002_5_1_7_1_15_1_18_0_8_1|"
+    "1_255_2_255_3_255_11_255_12_255_13_255_4_-1_6_1004_7_1_15_1_18_0_8_1|,"
+    "kA13,0,kA15,0,kA16,0,kA14,,kA6,0,kA7,0,kA25,0,kA17,0,kA18,0,kS39,0,kA2,0,kA3,0,kA8,0,"
+    "kA4,0,kA9,0,kA10,0,kA22,0,kA23,0,kA24,0,kA27,1,kA40,1,kA41,1,kA42,1,kA28,0,kA29,0,kA31,1,"
+    "kA32,1,kA36,0,kA43,0,kA44,0,kA45,1,kA46,0,kA33,1,kA34,1,kA35,0,kA37,1,kA38,1,kA39,1,"
+    "kA19,0,kA26,0,kA20,0,kA21,0,kA11,0;"
+    "1,1006,2,15,3,15,36,1,51,1,10,0.5,35,1,46,0.25,47,0.75;"
+    "1,901,2,15,3,15,36,1,51,1,28,0,29,0,10,0.5,30,0,85,2;"
+    "1,1007,2,15,3,15,36,1,51,1,10,0.5,35,0;"
+    "1,899,2,15,3,15,36,1,7,255,8,255,9,255,10,0.5,35,1,23,1000;"
+    "1,1,2,15,3,15,155,1;1,1,2,45,3,15,155,1;1,1,2,75,3,15,155,1;"
+    "1,1,2,15,3,15,21,1004,155,1;1,1,2,15,3,15,20,1,57,1,155,1;"
+    "1,8,2,15,3,15,155,1;1,7,2,15,3,15,155,1;1,211,2,15,3,15,21,1004,155,1;";
+
+static ZSTD_CDict* getCompressionDict() {
+    static auto dict = ZSTD_createCDict(TRASH_DICTIONARY.data(), TRASH_DICTIONARY.size(), COMPRESSION_LEVEL);
+    return dict;
+}
+static ZSTD_DDict* getDecompressionDict() {
+    static auto dict = ZSTD_createDDict(TRASH_DICTIONARY.data(), TRASH_DICTIONARY.size());
+    return dict;
+}
+
+static constexpr std::string_view LEVEL_STRING_START = "<k>k4</k><s>";
+static constexpr std::string_view LEVEL_STRING_END = "</s>";
+
+// Find the value of k4 in a plist as [start, end)
+static std::optional<std::pair<size_t, size_t>> findLevelString(std::string const& plist) {
+    auto start = plist.find(LEVEL_STRING_START);
+    if (start == std::string::npos) {
+        return std::nullopt;
+    }
+    start += LEVEL_STRING_START.size();
+    auto end = plist.find(LEVEL_STRING_END, start);
+    if (end == std::string::npos) {
+        return std::nullopt;
+    }
+    return std::make_pair(start, end);
+}
+
+static std::string escapeXML(std::string const& str) {
+    std::string res;
+    res.reserve(str.size());
+    for (auto c : str) {
+        switch (c) {
+            case '&': res += "&amp;"; break;
+            case '<': res += "&lt;"; break;
+            case '>': res += "&gt;"; break;
+            default: res.push_back(c); break;
+        }
+    }
+    return res;
+}
+
+static void writeU32(std::string& out, uint32_t value) {
+    for (size_t i = 0; i < 4; i += 1) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+static uint32_t readU32(std::string_view data, size_t offset) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; i += 1) {
+        value |= static_cast<uint32_t>(static_cast<uint8_t>(data[offset + i])) << (i * 8);
+    }
+    return value;
+}
+
+static double toMBPerSec(size_t bytes, std::chrono::steady_clock::duration time) {
+    auto secs = std::chrono::duration<double>(time).count();
+    return secs > 0 ? bytes / secs / (1024 * 1024) : 0;
+}
+
+static Result<std::string> readAll(std::filesystem::path const& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return Err("Unable to open file");
+    }
+    return Ok(std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()));
+}
+static Result<> writeAll(std::filesystem::path const& path, std::string_view data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return Err("Unable to open file for writing");
+    }
+    file.write(data.data(), data.size());
+    if (!file) {
+        return Err("Unable to write file");
+    }
+    return Ok();
+}
+
+bool isCompressedTrashFile(std::filesystem::path const& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[COMPRESSED_GMD_MAGIC.size()];
+    return file.read(magic, sizeof(magic)) && std::string_view(magic, sizeof(magic)) == COMPRESSED_GMD_MAGIC;
+}
+
+Result<> compressTrashFile(std::filesystem::path const& plain, std::filesystem::path const& out) {
+    auto startTime = std::chrono::steady_clock::now();
+    GEODE_UNWRAP_INTO(auto plist, readAll(plain));
+    auto plainSize = plist.size();
+
+    // Metadata block so listing doesn't need to decompress anything
+    auto meta = readGmdMetadata(plain).value_or(GmdMetadata());
+    auto metaBlock = fmt::format(
+        "<dict><k>kCEK</k><i>{}</i><k>k2</k><s>{}</s><k>k46</k><i>{}</i>"
+        "<k>k48</k><i>{}</i><k>k23</k><i>{}</i><k>k80</k><i>{}</i></dict>",
+        meta.type, escapeXML(meta.name), meta.revision, meta.objectCount, meta.length, meta.workingTime
+    );
+
+    // Inflate the level string, unless it's in some format we wouldn't be
+    // able to put back into a plist as-is
+    uint8_t flags = 0;
+    if (auto range = findLevelString(plist)) {
+        std::string inflated = ZipUtils::decompressString(plist.substr(range->first, range->second - range->first), false, 0);
+        if (inflated.size() && inflated.find_first_of("<&") == std::string::npos) {
+            plist.replace(range->first, range->second - range->first, inflated);
+            flags |= TrashCodecFlags::InflatedLevelString;
+        }
+    }
+
+    std::string compressed;
+    compressed.resize(ZSTD_compressBound(plist.size()));
+    auto ctx = ZSTD_createCCtx();
+    auto size = ZSTD_compress_usingCDict(ctx, compressed.data(), compressed.size(), plist.data(), plist.size(), getCompressionDict());
+    ZSTD_freeCCtx(ctx);
+    if (ZSTD_isError(size)) {
+        return Err("Unable to compress: {}", ZSTD_getErrorName(size));
+    }
+    compressed.resize(size);
+
+    std::string data;
+    data.reserve(COMPRESSED_GMD_MAGIC.size() + 4 + metaBlock.size() + 1 + compressed.size());
+    data += COMPRESSED_GMD_MAGIC;
+    writeU32(data, static_cast<uint32_t>(metaBlock.size()));
+    data += metaBlock;
+    data.push_back(static_cast<char>(flags));
+    data += compressed;
+    GEODE_UNWRAP(writeAll(out, data));
+
+    log::info(
+        "Compressed '{}': {} -> {} bytes ({:.1f}%) at {:.1f} MB/s",
+        out.filename(), plainSize, data.size(), data.size() * 100.0 / std::max<size_t>(plainSize, 1),
+        toMBPerSec(plainSize, std::chrono::steady_clock::now() - startTime)
+    );
+    return Ok();
+}
+
+// Decompress the zstd frame of a compressed file, leaving the level string
+// however it was stored. Returns the plist and the file's flags
+static Result<std::pair<std::string, uint8_t>> decompressFrame(std::string_view data) {
+    auto headerSize = COMPRESSED_GMD_MAGIC.size() + 4;
+    if (data.size() < headerSize + 1 || !data.starts_with(COMPRESSED_GMD_MAGIC)) {
+        return Err("Not a compressed trash file");
+    }
+    auto offset = headerSize + readU32(data, COMPRESSED_GMD_MAGIC.size());
+    if (offset + 1 > data.size()) {
+        return Err("Compressed trash file is truncated");
+    }
+    auto flags = static_cast<uint8_t>(data[offset]);
+    auto frame = std::string_view(data).substr(offset + 1);
+
+    auto plainSize = ZSTD_getFrameContentSize(frame.data(), frame.size());
+    if (plainSize == ZSTD_CONTENTSIZE_ERROR || plainSize == ZSTD_CONTENTSIZE_UNKNOWN) {
+        return Err("Compressed trash file is corrupted");
+    }
+    std::string plist;
+    plist.resize(plainSize);
+    auto ctx = ZSTD_createDCtx();
+    auto size = ZSTD_decompress_usingDDict(ctx, plist.data(), plist.size(), frame.data(), frame.size(), getDecompressionDict());
+    ZSTD_freeDCtx(ctx);
+    if (ZSTD_isError(size)) {
+        return Err("Unable to decompress: {}", ZSTD_getErrorName(size));
+    }
+    plist.resize(size);
+    return Ok(std::make_pair(std::move(plist), flags));
+}
+
+Result<std::string> decompressTrashData(std::string_view data) {
+    GEODE_UNWRAP_INTO(auto frame, decompressFrame(data));
+    auto& [plist, flags] = frame;
+    if (flags & TrashCodecFlags::InflatedLevelString) {
+        auto range = findLevelString(plist);
+        if (!range) {
+            return Err("Compressed trash file is missing its level string");
+        }
+        auto encoded = encodeLevelString(plist.substr(range->first, range->second - range->first));
+        plist.replace(range->first, range->second - range->first, encoded);
+    }
+    return Ok(std::move(plist));
+}
+
+Result<> decompressTrashFile(std::filesystem::path const& compressed, std::filesystem::path const& out) {
+    auto startTime = std::chrono::steady_clock::now();
+    GEODE_UNWRAP_INTO(auto data, readAll(compressed));
+    GEODE_UNWRAP_INTO(auto plist, decompressTrashData(data));
+    GEODE_UNWRAP(writeAll(out, plist));
+
+    log::info(
+        "Decompressed '{}': {} -> {} bytes at {:.1f} MB/s",
+        compressed.filename(), data.size(), plist.size(),
+        toMBPerSec(plist.size(), std::chrono::steady_clock::now() - startTime)
+    );
+    return Ok();
+}
+
+Result<std::string> readTrashedLevelString(std::string_view data) {
+    std::string plist;
+    bool inflated = false;
+    if (data.starts_with(COMPRESSED_GMD_MAGIC)) {
+        GEODE_UNWRAP_INTO(auto frame, decompressFrame(data));
+        plist = std::move(frame.first);
+        inflated = frame.second & TrashCodecFlags::InflatedLevelString;
+    }
+    else {
+        plist = std::string(data);
+    }
+    auto range = findLevelString(plist);
+    if (!range) {
+        return Err("Level has no level string");
+    }
+    if (inflated) {
+        return Ok(plist.substr(range->first, range->second - range->first));
+    }
+    auto decoded = decodeLevelString(std::string_view(plist).substr(range->first, range->second - range->first));
+    if (!decoded) {
+        return Err("Level string is corrupted");
+    }
+    return Ok(std::move(*decoded));
+}
+
+std::optional<SplitLevelString> splitLevelString(std::string_view plist) {
+    auto str = std::string(plist);
+    auto range = findLevelString(str);
+    if (!range) {
+        return std::nullopt;
+    }
+    SplitLevelString split;
+    split.head = str.substr(0, range->first);
+    split.levelString = str.substr(range->first, range->second - range->first);
+    split.tail = str.substr(range->second);
+    // Same as when compressing, only keep it inflated if it can go back
+    // into a plist as-is
+    std::string inflated = ZipUtils::decompressString(split.levelString, false, 0);
+    if (inflated.size() && inflated.find_first_of("<&") == std::string::npos) {
+        split.levelString = std::move(inflated);
+        split.inflated = true;
+    }
+    return split;
+}
+std::string encodeLevelString(std::string const& inflated) {
+    return ZipUtils::compressString(inflated, false, 0);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <filesystem>
+#include <Geode/utils/cocos.hpp>
+
+using namespace geode::prelude;
+
+/**
+ * Compressed storage for trashed items. A compressed file (.gmdz / .gmdlz) 
+ * looks like this:
+ *
+ *   "BSZ1"              magic
+ *   u32 (LE)            size of the metadata block
+ *   metadata block      small plain plist dict with the keys GmdReader reads,
+ *                       so listing the trash never has to decompress anything
+ *   u8                  flags (see TrashCodecFlags)
+ *   zstd frame          the .gmd plist, compressed with a dictionary built 
+ *                       from typical GD plist / level string content
+ *
+ * Level strings are normally stored base64 + gzip encoded, which zstd can't 
+ * do anything with, so they are inflated before compressing and re-encoded 
+ * when the file is decompressed
+ */
+enum TrashCodecFlags : uint8_t {
+    // The level string (k4) is stored inflated
+    InflatedLevelString = 0b1,
+};
+
+bool isCompressedTrashFile(std::filesystem::path const& path);
+
+// Both of these only do file & string work, so they are safe to run on the 
+// worker pool
+Result<> compressTrashFile(std::filesystem::path const& plain, std::filesystem::path const& out);
+Result<> decompressTrashFile(std::filesystem::path const& compressed, std::filesystem::path const& out);
+// Same as decompressTrashFile, with the file's contents already in memory. 
+// Returns the plain plist
+Result<std::string> decompressTrashData(std::string_view data);
+// The decoded level string of a trashed level, from its file's contents 
+// (compressed or not). Levels stored inflated skip decoding altogether
+Result<std::string> readTrashedLevelString(std::string_view data);
+
+// A plist split around its level string (k4), for storing the level string 
+// somewhere else
+struct SplitLevelString final {
+    std::string head;
+    std::string levelString;
+    std::string tail;
+    // Whether the level string was inflated, and has to be encoded again
+    bool inflated = false;
+};
+// Returns nullopt if the plist doesn't have a level string
+std::optional<SplitLevelString> splitLevelString(std::string_view plist);
+std::string encodeLevelString(std::string const& inflated);
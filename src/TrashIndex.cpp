@@ -0,0 +1,436 @@
+#include "TrashIndex.hpp"
+#include "Mod.hpp"
+#include "TrashStorage.hpp"
+#include "core/GmdReader.hpp"
+#include "core/WorkerPool.hpp"
+#include <Geode/utils/file.hpp>
+#include <unordered_set>
+#include <hjfod.gmd-api/include/GMD.hpp>
+
+using namespace geode::prelude;
+
+// Bump if the stored fields change so old indices get rebuilt
+static constexpr int TRASH_INDEX_VERSION = 1;
+
+int64_t toUnixTime(std::filesystem::file_time_type time) {
+    // Same file_clock -> system_clock hack as in TrashcanPopup since
+    // clock_cast is not available on Android
+    auto sys = time - std::filesystem::file_time_type::clock::now() + std::chrono::system_clock::now();
+    return std::chrono::duration_cast<std::chrono::seconds>(sys.time_since_epoch()).count();
+}
+std::filesystem::file_time_type fromUnixTime(int64_t time) {
+    auto sys = std::chrono::system_clock::time_point(std::chrono::seconds(time));
+    return std::chrono::time_point_cast<std::filesystem::file_time_type::duration>(
+        sys - std::chrono::system_clock::now() + std::filesystem::file_time_type::clock::now()
+    );
+}
+
+static uintmax_t fileSizeOf(std::filesystem::path const& file) {
+    return TrashStorage::get()->getFileSize(file);
+}
+
+TrashedInfo TrashedInfo::from(GJGameLevel* level, std::filesystem::path const& file) {
+    TrashedInfo info;
+    info.filename = file.filename().string();
+    info.type = TrashedType::Level;
+    info.name = level->m_levelName;
+    info.objectCount = level->m_objectCount.value();
+    info.length = level->m_levelLength;
+    info.editorTime = level->m_workingTime;
+    info.fileSize = fileSizeOf(file);
+    info.trashTime = toUnixTime(std::filesystem::file_time_type::clock::now());
+    return info;
+}
+TrashedInfo TrashedInfo::from(GJLevelList* list, std::filesystem::path const& file) {
+    TrashedInfo info;
+    info.filename = file.filename().string();
+    info.type = TrashedType::List;
+    info.name = list->m_listName;
+    info.levelCount = list->m_levels.size();
+    info.fileSize = fileSizeOf(file);
+    info.trashTime = toUnixTime(std::filesystem::file_time_type::clock::now());
+    return info;
+}
+
+std::optional<TrashedInfo> TrashedInfo::fromMetadata(std::filesystem::path const& file) {
+    BETTERSAVE_PROFILE("TrashedInfo::fromMetadata");
+    if (auto info = TrashStorage::get()->getPackedInfo(file)) {
+        return info;
+    }
+    auto meta = readGmdMetadata(file);
+    if (!meta || !meta->isLevel()) {
+        return std::nullopt;
+    }
+    TrashedInfo info;
+    info.filename = file.filename().string();
+    info.type = TrashedType::Level;
+    info.name = meta->name;
+    info.objectCount = meta->objectCount;
+    info.length = meta->length;
+    info.editorTime = meta->workingTime;
+    info.fileSize = fileSizeOf(file);
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(file, ec);
+    info.trashTime = toUnixTime(ec ? std::filesystem::file_time_type::clock::now() : time);
+    return info;
+}
+std::optional<TrashedInfo> TrashedInfo::from(std::filesystem::path const& file) {
+    // Packed without metadata (moved into the archive before it was
+    // indexed), so it has to be written out to be read
+    if (TrashStorage::get()->isPacked(file)) {
+        auto scratch = getTrashDir() / (".restore-" + file.filename().string());
+        auto extracted = TrashStorage::get()->extract(file, scratch);
+        if (!extracted) {
+            return std::nullopt;
+        }
+        auto info = TrashedInfo::from(*extracted);
+        std::error_code ec;
+        std::filesystem::remove(scratch, ec);
+        if (info) {
+            info->filename = file.filename().string();
+            info->fileSize = fileSizeOf(file);
+        }
+        return info;
+    }
+    if (auto info = TrashedInfo::fromMetadata(file)) {
+        return info;
+    }
+    std::optional<TrashedInfo> info;
+    if (auto list = importTrashedList(file)) {
+        info = TrashedInfo::from(*list, file);
+    }
+    // Not a plist we could read, so let gmd-api figure out what it is
+    else if (auto level = importTrashedLevel(file)) {
+        info = TrashedInfo::from(*level, file);
+    }
+    if (!info) {
+        return std::nullopt;
+    }
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(file, ec);
+    info->trashTime = toUnixTime(ec ? std::filesystem::file_time_type::clock::now() : time);
+    return info;
+}
+
+bool matjson::Serialize<TrashedInfo>::is_json(matjson::Value const& value) {
+    return value.is_object() &&
+        value.contains("file") && value["file"].is_string() &&
+        value.contains("type") && value["type"].is_string() &&
+        value.contains("name") && value["name"].is_string();
+}
+TrashedInfo matjson::Serialize<TrashedInfo>::from_json(matjson::Value const& value) {
+    auto const num = [&](const char* key) -> double {
+        return value.contains(key) && value[key].is_number() ? value[key].as_double() : 0;
+    };
+    TrashedInfo info;
+    info.filename = value["file"].as_string();
+    info.type = value["type"].as_string() == "list" ? TrashedType::List : TrashedType::Level;
+    info.name = value["name"].as_string();
+    info.objectCount = static_cast<int>(num("objects"));
+    info.length = static_cast<int>(num("length"));
+    info.editorTime = static_cast<int>(num("editor-time"));
+    info.levelCount = static_cast<size_t>(num("levels"));
+    info.fileSize = static_cast<uintmax_t>(num("size"));
+    info.trashTime = static_cast<int64_t>(num("trashed"));
+    if (value.contains("stats") && value["stats"].is_object()) {
+        auto& stats = value["stats"];
+        auto const statNum = [&](const char* key) -> double {
+            return stats.contains(key) && stats[key].is_number() ? stats[key].as_double() : 0;
+        };
+        LevelStats res;
+        res.objectCount = static_cast<size_t>(statNum("objects"));
+        res.triggerCount = static_cast<size_t>(statNum("triggers"));
+        res.groupCount = static_cast<size_t>(statNum("groups"));
+        res.groupedObjects = static_cast<size_t>(statNum("grouped"));
+        res.decodedSize = static_cast<uint64_t>(statNum("decoded-size"));
+        if (stats.contains("top") && stats["top"].is_array()) {
+            for (auto& entry : stats["top"].as_array()) {
+                if (!entry.is_array() || entry.as_array().size() != 2) {
+                    continue;
+                }
+                auto& pair = entry.as_array();
+                if (pair[0].is_number() && pair[1].is_number()) {
+                    res.objectsByID.push_back({ pair[0].as_int(), static_cast<size_t>(pair[1].as_double()) });
+                }
+            }
+        }
+        info.stats = std::move(res);
+    }
+    return info;
+}
+matjson::Value matjson::Serialize<TrashedInfo>::to_json(TrashedInfo const& info) {
+    auto obj = matjson::Object();
+    obj["file"] = info.filename;
+    obj["type"] = info.type == TrashedType::List ? "list" : "level";
+    obj["name"] = info.name;
+    if (info.type == TrashedType::List) {
+        obj["levels"] = static_cast<double>(info.levelCount);
+    }
+    else {
+        obj["objects"] = info.objectCount;
+        obj["length"] = info.length;
+        obj["editor-time"] = info.editorTime;
+        if (info.stats) {
+            // Object IDs with their counts, as [id, count] pairs
+            auto top = matjson::Array();
+            for (auto& [id, count] : info.stats->objectsByID) {
+                auto pair = matjson::Array();
+                pair.push_back(id);
+                pair.push_back(static_cast<double>(count));
+                top.push_back(pair);
+            }
+            auto stats = matjson::Object();
+            stats["objects"] = static_cast<double>(info.stats->objectCount);
+            stats["triggers"] = static_cast<double>(info.stats->triggerCount);
+            stats["groups"] = static_cast<double>(info.stats->groupCount);
+            stats["grouped"] = static_cast<double>(info.stats->groupedObjects);
+            stats["decoded-size"] = static_cast<double>(info.stats->decodedSize);
+            stats["top"] = top;
+            obj["stats"] = stats;
+        }
+    }
+    // Stored as doubles since these easily overflow an int
+    obj["size"] = static_cast<double>(info.fileSize);
+    obj["trashed"] = static_cast<double>(info.trashTime);
+    return obj;
+}
+
+TrashIndex* TrashIndex::get() {
+    static auto inst = new TrashIndex();
+    return inst;
+}
+std::filesystem::path TrashIndex::getPath() {
+    // Hidden so it's easy to tell apart from the actual trashed files
+    return getTrashDir() / ".index.json";
+}
+
+std::map<std::string, TrashedInfo> TrashIndex::readFromDisk() {
+    std::map<std::string, TrashedInfo> entries;
+    auto json = file::readFromJson<matjson::Value>(getPath());
+    if (
+        json && json->is_object() &&
+        json->contains("version") && json->as_object()["version"] == TRASH_INDEX_VERSION &&
+        json->contains("items") && json->as_object()["items"].is_array()
+    ) {
+        for (auto& item : json->as_object()["items"].as_array()) {
+            if (matjson::Serialize<TrashedInfo>::is_json(item)) {
+                auto info = matjson::Serialize<TrashedInfo>::from_json(item);
+                entries.insert({ info.filename, info });
+            }
+        }
+    }
+    return entries;
+}
+
+void TrashIndex::load() {
+    if (!m_loaded) {
+        m_loaded = true;
+        this->setEntries(TrashIndex::readFromDisk());
+    }
+}
+void TrashIndex::adopt(std::map<std::string, TrashedInfo>&& entries) {
+    if (!m_loaded) {
+        m_loaded = true;
+        this->setEntries(std::move(entries));
+    }
+}
+
+void TrashIndex::setEntries(std::map<std::string, TrashedInfo>&& entries) {
+    m_entries = std::move(entries);
+    m_revision += 1;
+    m_totalSize = 0;
+    for (auto& [_, info] : m_entries) {
+        m_totalSize += info.fileSize;
+    }
+}
+void TrashIndex::insert(TrashedInfo const& info) {
+    m_revision += 1;
+    auto [it, inserted] = m_entries.try_emplace(info.filename, info);
+    if (!inserted) {
+        m_totalSize -= it->second.fileSize;
+        it->second = info;
+    }
+    m_totalSize += info.fileSize;
+}
+bool TrashIndex::erase(std::string const& filename) {
+    auto it = m_entries.find(filename);
+    if (it == m_entries.end()) {
+        return false;
+    }
+    m_revision += 1;
+    m_totalSize -= it->second.fileSize;
+    m_entries.erase(it);
+    return true;
+}
+
+TrashIndex::PruneResult TrashIndex::prune(std::vector<std::filesystem::path> const& files) {
+    this->load();
+    PruneResult result;
+    std::unordered_set<std::string> present;
+    for (auto& file : files) {
+        auto filename = file.filename().string();
+        if (filename.starts_with(".")) {
+            continue;
+        }
+        present.insert(filename);
+        if (!m_entries.contains(filename)) {
+            result.unindexed.push_back(file);
+        }
+    }
+    // Drop entries whose files have disappeared
+    for (auto& [filename, _] : m_entries) {
+        if (!present.contains(filename)) {
+            result.removed.push_back(filename);
+        }
+    }
+    for (auto& filename : result.removed) {
+        this->erase(filename);
+    }
+    if (result.removed.size()) {
+        this->save();
+    }
+    return result;
+}
+
+void TrashIndex::reconcile() {
+    std::vector<TrashedInfo> infos;
+    for (auto& file : this->prune(TrashStorage::get()->list()).unindexed) {
+        // Not in the index - either trashed before the index existed or
+        // placed in the directory by hand, so it has to be read once
+        auto info = TrashedInfo::from(file);
+        if (!info) {
+            log::warn("Unable to index trashed file '{}'", file.filename());
+            continue;
+        }
+        infos.push_back(*info);
+    }
+    this->add(infos);
+    m_reconciled = true;
+}
+bool TrashIndex::isReconciled() const {
+    return m_reconciled;
+}
+void TrashIndex::markReconciled() {
+    m_reconciled = true;
+}
+
+std::map<std::string, TrashedInfo> const& TrashIndex::getEntries() {
+    this->load();
+    return m_entries;
+}
+bool TrashIndex::isLoaded() const {
+    return m_loaded;
+}
+size_t TrashIndex::getCount() const {
+    return m_entries.size();
+}
+uintmax_t TrashIndex::getTotalSize() const {
+    return m_totalSize;
+}
+size_t TrashIndex::getRevision() const {
+    return m_revision;
+}
+
+void TrashIndex::add(TrashedInfo const& info) {
+    this->load();
+    this->insert(info);
+    this->save();
+}
+void TrashIndex::add(std::vector<TrashedInfo> const& infos) {
+    if (infos.empty()) {
+        return;
+    }
+    this->load();
+    for (auto& info : infos) {
+        this->insert(info);
+    }
+    this->save();
+}
+void TrashIndex::remove(std::string const& filename) {
+    this->load();
+    if (this->erase(filename)) {
+        this->save();
+    }
+}
+void TrashIndex::remove(std::vector<std::string> const& filenames) {
+    this->load();
+    size_t removed = 0;
+    for (auto& filename : filenames) {
+        removed += this->erase(filename);
+    }
+    if (removed) {
+        this->save();
+    }
+}
+void TrashIndex::clear() {
+    m_loaded = true;
+    m_reconciled = true;
+    m_entries.clear();
+    m_revision += 1;
+    m_totalSize = 0;
+    this->save();
+}
+
+void TrashIndex::save() {
+    // Everything that changes in the same frame is only written once
+    if (m_saveQueued) {
+        return;
+    }
+    m_saveQueued = true;
+    Loader::get()->queueInMainThread([this] {
+        m_saveQueued = false;
+        auto items = matjson::Array();
+        for (auto& [_, info] : m_entries) {
+            items.push_back(matjson::Serialize<TrashedInfo>::to_json(info));
+        }
+        auto json = matjson::Object();
+        json["version"] = TRASH_INDEX_VERSION;
+        json["items"] = items;
+        {
+            std::lock_guard lock(m_saveMutex);
+            m_pendingSave = matjson::Value(json).dump(matjson::NO_INDENTATION);
+            // The writer picks up the newest index once it's done
+            if (m_writing) {
+                return;
+            }
+            m_writing = true;
+        }
+        WorkerPool::get()->submit([this] {
+            this->writePending();
+        });
+    });
+}
+void TrashIndex::writePending() {
+    BETTERSAVE_PROFILE("TrashIndex::write");
+    while (true) {
+        std::string data;
+        {
+            std::lock_guard lock(m_saveMutex);
+            if (!m_pendingSave) {
+                m_writing = false;
+                return;
+            }
+            data = std::move(*m_pendingSave);
+            m_pendingSave = std::nullopt;
+        }
+        // Written next to the index and renamed over it, so a crash can't 
+        // leave a half-written index behind
+        (void)file::createDirectoryAll(getTrashDir());
+        auto tmp = getTrashDir() / ".index.json.new";
+        std::error_code ec;
+        auto res = file::writeString(tmp, data);
+        if (res && !syncFile(tmp)) {
+            res = Err("Unable to flush file to disk");
+        }
+        if (res) {
+            std::filesystem::rename(tmp, getPath(), ec);
+            if (ec) {
+                res = Err("{} (code {})", ec.message(), ec.value());
+            }
+        }
+        if (!res) {
+            log::warn("Unable to save the trash index: {}", res.unwrapErr());
+            std::filesystem::remove(tmp, ec);
+        }
+    }
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <filesystem>
+#include <Geode/utils/cocos.hpp>
+#include "core/LevelStats.hpp"
+
+using namespace geode::prelude;
+
+enum class TrashedType {
+    Level,
+    List,
+};
+
+// Everything the Trashcan needs to show about a trashed item without having
+// to import the whole .gmd file
+struct TrashedInfo final {
+    std::string filename;
+    TrashedType type = TrashedType::Level;
+    std::string name;
+    int objectCount = 0;
+    int length = 0;
+    int editorTime = 0;
+    size_t levelCount = 0;
+    uintmax_t fileSize = 0;
+    // Unix timestamp (seconds) of when the item was trashed
+    int64_t trashTime = 0;
+    // Exact counts from the level string, once the level's info has been 
+    // looked at. Only the most common object IDs are kept
+    std::optional<LevelStats> stats;
+
+    static TrashedInfo from(GJGameLevel* level, std::filesystem::path const& file);
+    static TrashedInfo from(GJLevelList* list, std::filesystem::path const& file);
+    // Index a file already in the trash directory. Levels are only read up to
+    // their metadata, but lists have to be imported (they are tiny anyway)
+    static std::optional<TrashedInfo> from(std::filesystem::path const& file);
+    // Same as above, but only handles levels and never touches Cocos, so it 
+    // is safe to call from any thread
+    static std::optional<TrashedInfo> fromMetadata(std::filesystem::path const& file);
+};
+
+// The index stores plain Unix timestamps; these convert to and from the file
+// clock the rest of the trash code uses
+int64_t toUnixTime(std::filesystem::file_time_type time);
+std::filesystem::file_time_type fromUnixTime(int64_t time);
+
+template <>
+struct matjson::Serialize<TrashedInfo> {
+    static bool is_json(matjson::Value const& value);
+    static TrashedInfo from_json(matjson::Value const& value);
+    static matjson::Value to_json(TrashedInfo const& info);
+};
+
+/**
+ * Sidecar index of the trash directory, stored as a hidden file inside it.
+ * Kept in sync by Trashed whenever it adds or removes items, and reconciled
+ * against the directory listing so files added or removed behind our back 
+ * are picked up (only those files are ever read). Main thread only, except 
+ * for readFromDisk
+ * 
+ * The item count and total size are kept up to date as entries change, so 
+ * the UI can read them without touching the disk. Changes are written out 
+ * on the worker pool, at most once per frame
+ */
+class TrashIndex final {
+protected:
+    std::map<std::string, TrashedInfo> m_entries;
+    uintmax_t m_totalSize = 0;
+    size_t m_revision = 0;
+    bool m_loaded = false;
+    bool m_reconciled = false;
+    bool m_saveQueued = false;
+
+    // The newest serialized index not written yet, and whether a worker is 
+    // currently writing
+    std::mutex m_saveMutex;
+    std::optional<std::string> m_pendingSave;
+    bool m_writing = false;
+
+    TrashIndex() = default;
+
+    // Write the index on the worker pool at the end of the frame
+    void save();
+    void writePending();
+
+    void load();
+    void setEntries(std::map<std::string, TrashedInfo>&& entries);
+    void insert(TrashedInfo const& info);
+    bool erase(std::string const& filename);
+
+public:
+    static TrashIndex* get();
+    static std::filesystem::path getPath();
+    static std::map<std::string, TrashedInfo> readFromDisk();
+
+    // Use entries read by readFromDisk on another thread, unless the index 
+    // has already been loaded
+    void adopt(std::map<std::string, TrashedInfo>&& entries);
+    struct PruneResult final {
+        // Files in the listing that aren't indexed yet
+        std::vector<std::filesystem::path> unindexed;
+        // Filenames of the entries that were dropped
+        std::vector<std::string> removed;
+    };
+    // Drop entries not in the given directory listing
+    PruneResult prune(std::vector<std::filesystem::path> const& files);
+    // Synchronously prune and index everything that's missing
+    void reconcile();
+    bool isReconciled() const;
+    void markReconciled();
+
+    std::map<std::string, TrashedInfo> const& getEntries();
+    // These only reflect what has been loaded so far and never load the 
+    // index themselves
+    bool isLoaded() const;
+    size_t getCount() const;
+    uintmax_t getTotalSize() const;
+    // Bumped on every change, to tell if a directory listing taken in the 
+    // background is still current
+    size_t getRevision() const;
+
+    void add(TrashedInfo const& info);
+    void add(std::vector<TrashedInfo> const& infos);
+    void remove(std::string const& filename);
+    void remove(std::vector<std::string> const& filenames);
+    void clear();
+};
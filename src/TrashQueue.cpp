@@ -0,0 +1,174 @@
+#include "TrashQueue.hpp"
+#include "Mod.hpp"
+#include "core/WorkerPool.hpp"
+#include "TrashCodec.hpp"
+#include "TrashStorage.hpp"
+#include <algorithm>
+
+using namespace geode::prelude;
+
+TrashQueue* TrashQueue::get() {
+    static auto inst = new TrashQueue();
+    return inst;
+}
+
+std::filesystem::path TrashQueue::getTempPathFor(std::filesystem::path const& target) {
+    // Hidden, so the trash index skips it
+    return target.parent_path() / ("." + target.filename().string() + ".tmp");
+}
+
+void TrashQueue::recover() {
+    for (auto file : file::readDirectory(getTrashDir()).unwrapOrDefault()) {
+        auto filename = file.filename().string();
+        std::error_code ec;
+        // Scratch files from exporting, compressing and decompressing items
+        if (filename.starts_with(".") && (filename.ends_with(".plain") || filename.ends_with(".head") || (filename.starts_with(".restore") && filename.ends_with(".gmd")))) {
+            std::filesystem::remove(file, ec);
+            continue;
+        }
+        if (!filename.starts_with(".") || !filename.ends_with(".tmp")) {
+            continue;
+        }
+        // Saving the local levels flushes the queue first, so a temp file 
+        // that never got committed means the local levels on disk were never 
+        // saved without the item. Committing it anyway would leave the item 
+        // both in the trash and in the local levels, so it's dropped even if 
+        // it was written in full
+        log::warn("Discarding uncommitted trash file '{}'", filename);
+        std::filesystem::remove(file, ec);
+    }
+    syncDirectory(getTrashDir());
+}
+
+void TrashQueue::push(std::filesystem::path const& target, WriteFunc write, DoneFunc onDone) {
+    std::vector<Item> items;
+    items.push_back(Item { target, std::move(write) });
+    this->push(std::move(items), [onDone = std::move(onDone)](auto const& results) {
+        if (onDone) {
+            onDone(results.front());
+        }
+    });
+}
+void TrashQueue::push(std::vector<Item> items, BatchDoneFunc onDone) {
+    if (items.empty()) {
+        return;
+    }
+    auto id = m_nextJobID++;
+    Job job { {}, std::move(onDone) };
+    for (auto& item : items) {
+        job.targets.push_back(item.target);
+        reserveID(item.target);
+    }
+    m_jobs.insert({ id, std::move(job) });
+    {
+        std::lock_guard lock(m_mutex);
+        m_inFlight += 1;
+    }
+    WorkerPool::get()->submit([this, id, items = std::move(items)] {
+        BETTERSAVE_PROFILE("TrashQueue::write");
+        // Encoding is the slow part, so spread it over the pool, and sync 
+        // each file right after so the disk can merge the flushes
+        std::vector<Result<>> results(items.size(), Ok());
+        WorkerPool::get()->parallelFor(items.size(), [&](size_t i) {
+            auto tmp = TrashQueue::getTempPathFor(items[i].target);
+            auto res = items[i].write(tmp);
+            if (res && !syncFile(tmp)) {
+                res = Err("Unable to flush file to disk");
+            }
+            results[i] = res;
+        });
+
+        // Commit everything that was written in one go
+        std::vector<TrashStorage::Commit> commits;
+        std::vector<size_t> committed;
+        for (size_t i = 0; i < items.size(); i += 1) {
+            auto tmp = TrashQueue::getTempPathFor(items[i].target);
+            if (results[i]) {
+                commits.push_back(TrashStorage::Commit { tmp, items[i].target, items[i].metadata });
+                committed.push_back(i);
+            }
+            else {
+                std::error_code ec;
+                std::filesystem::remove(tmp, ec);
+            }
+        }
+        auto commitResults = TrashStorage::get()->commit(commits);
+        for (size_t j = 0; j < committed.size(); j += 1) {
+            results[committed[j]] = commitResults[j];
+        }
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_completed.push_back({ id, std::move(results) });
+            m_inFlight -= 1;
+        }
+        m_condition.notify_all();
+        // flush() may have gotten to the callbacks first
+        Loader::get()->queueInMainThread([this] {
+            this->finishCompleted();
+        });
+    });
+}
+
+void TrashQueue::finishCompleted() {
+    std::vector<std::pair<size_t, std::vector<Result<>>>> completed;
+    {
+        std::lock_guard lock(m_mutex);
+        completed.swap(m_completed);
+    }
+    for (auto& [id, results] : completed) {
+        this->finish(id, results);
+    }
+}
+
+void TrashQueue::finish(size_t id, std::vector<Result<>> const& results) {
+    auto it = m_jobs.find(id);
+    if (it == m_jobs.end()) {
+        return;
+    }
+    auto job = std::move(it->second);
+    m_jobs.erase(it);
+    // Creating a file may have failed because something else put a file 
+    // there, so have the directory be checked again
+    for (size_t i = 0; i < results.size(); i += 1) {
+        if (!results[i]) {
+            invalidateIDs(job.targets[i].parent_path());
+            break;
+        }
+    }
+    if (job.onDone) {
+        job.onDone(results);
+    }
+}
+
+bool TrashQueue::isPending(std::filesystem::path const& target) const {
+    for (auto& [_, job] : m_jobs) {
+        if (std::find(job.targets.begin(), job.targets.end(), target) != job.targets.end()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::filesystem::path> TrashQueue::getPendingTargets() const {
+    std::vector<std::filesystem::path> targets;
+    for (auto& [_, job] : m_jobs) {
+        targets.insert(targets.end(), job.targets.begin(), job.targets.end());
+    }
+    return targets;
+}
+
+void TrashQueue::flush() {
+    BETTERSAVE_PROFILE("TrashQueue::flush");
+    {
+        std::unique_lock lock(m_mutex);
+        m_condition.wait(lock, [this] { return m_inFlight == 0; });
+    }
+    // Whoever flushes is about to rely on the trash being up to date, so 
+    // the callbacks can't wait for the next frame
+    this->finishCompleted();
+}
+
+$execute {
+    TrashQueue::recover();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <Geode/utils/cocos.hpp>
+
+using namespace geode::prelude;
+
+/**
+ * Write-behind queue for files going into the trash. The actual encoding and
+ * writing happens on the worker pool; each file is written to a hidden temp
+ * file next to its target, synced to disk and then renamed into place, so a
+ * file in the trash directory is always complete. Items pushed together as a
+ * batch are encoded in parallel, synced together and share a single sync of
+ * the directory.
+ *
+ * The queue is flushed before LocalLevelManager saves, so anything removed
+ * from the saved local levels is guaranteed to be in the trash. Temp files
+ * left over from a crash are either finished (renamed into place) or thrown
+ * away on startup
+ */
+class TrashQueue final {
+public:
+    // Runs on a worker thread; must not touch Cocos objects at all, so 
+    // anything it writes has to be serialized on the main thread first
+    using WriteFunc = std::function<Result<>(std::filesystem::path const& tmp)>;
+    // Runs on the main thread once the file has been committed (or failed)
+    using DoneFunc = std::function<void(Result<> const& result)>;
+    // Same as above, with the results in the order the items were pushed
+    using BatchDoneFunc = std::function<void(std::vector<Result<>> const& results)>;
+
+    struct Item final {
+        std::filesystem::path target;
+        WriteFunc write;
+        // Stored alongside the item if it goes into the packed trash
+        std::string metadata;
+    };
+
+protected:
+    struct Job final {
+        std::vector<std::filesystem::path> targets;
+        BatchDoneFunc onDone;
+    };
+
+    // Main thread only
+    std::unordered_map<size_t, Job> m_jobs;
+    size_t m_nextJobID = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    size_t m_inFlight = 0;
+    // Jobs that have been written but whose callbacks haven't run yet
+    std::vector<std::pair<size_t, std::vector<Result<>>>> m_completed;
+
+    TrashQueue() = default;
+
+    void finish(size_t id, std::vector<Result<>> const& results);
+    // Run the callbacks of every completed job. Main thread only
+    void finishCompleted();
+
+public:
+    static TrashQueue* get();
+
+    static std::filesystem::path getTempPathFor(std::filesystem::path const& target);
+    // Discard temp files left behind by a crash
+    static void recover();
+
+    void push(std::filesystem::path const& target, WriteFunc write, DoneFunc onDone);
+    void push(std::vector<Item> items, BatchDoneFunc onDone);
+    bool isPending(std::filesystem::path const& target) const;
+    // Files that have been queued but not committed yet
+    std::vector<std::filesystem::path> getPendingTargets() const;
+    // Block until every queued file has been committed to disk, and run 
+    // their callbacks before returning
+    void flush();
+};
@@ -0,0 +1,89 @@
+#include "TrashRetention.hpp"
+#include "core/WorkerPool.hpp"
+#include <Geode/loader/SettingV3.hpp>
+
+static bool ASKED = false;
+
+RetentionLimits TrashRetention::getLimits() {
+    RetentionLimits limits;
+    limits.maxTotalSize = static_cast<uintmax_t>(Mod::get()->getSettingValue<int64_t>("trash-max-size")) * 1024 * 1024;
+    limits.maxAge = Mod::get()->getSettingValue<int64_t>("trash-max-age") * 24 * 60 * 60;
+    limits.maxCount = static_cast<size_t>(Mod::get()->getSettingValue<int64_t>("trash-max-items"));
+    return limits;
+}
+
+void TrashRetention::findExpired(ExpiredCallback callback) {
+    auto limits = TrashRetention::getLimits();
+    if (limits.isUnlimited()) {
+        return callback({});
+    }
+    std::vector<TrashedInfo> infos;
+    for (auto& [_, info] : TrashIndex::get()->getEntries()) {
+        infos.push_back(info);
+    }
+    WorkerPool::get()->submit([limits, infos = std::move(infos), callback = std::move(callback)] {
+        BETTERSAVE_PROFILE("TrashRetention::findExpired");
+        std::vector<RetentionItem> items;
+        items.reserve(infos.size());
+        for (auto& info : infos) {
+            items.push_back(RetentionItem { info.fileSize, info.trashTime });
+        }
+        auto now = toUnixTime(std::filesystem::file_time_type::clock::now());
+        std::vector<TrashedInfo> expired;
+        for (auto i : selectExpired(items, limits, now)) {
+            expired.push_back(infos[i]);
+        }
+        Loader::get()->queueInMainThread([expired = std::move(expired), callback] {
+            // Skip anything that was restored or deleted in the meantime
+            auto& entries = TrashIndex::get()->getEntries();
+            std::vector<Ref<Trashed>> items;
+            for (auto& info : expired) {
+                if (entries.contains(info.filename)) {
+                    items.push_back(Trashed::create(getTrashDir() / info.filename, info));
+                }
+            }
+            callback(items);
+        });
+    });
+}
+
+void TrashRetention::check() {
+    if (ASKED) {
+        return;
+    }
+    TrashRetention::findExpired([](auto const& expired) {
+        if (expired.empty() || ASKED) {
+            return;
+        }
+        ASKED = true;
+        uintmax_t size = 0;
+        for (auto& item : expired) {
+            size += item->getInfo().fileSize;
+        }
+        createQuickPopup(
+            "Trash Over Limit",
+            fmt::format(
+                "<cy>{}</c> item{} in the Trashcan ({:.1f} MB) {} over your <co>trash limits</c>. "
+                "Permanently delete {}, oldest first?\n"
+                "<cr>This can NOT be undone!</c>",
+                expired.size(), expired.size() == 1 ? "" : "s", size / (1024.0 * 1024.0),
+                expired.size() == 1 ? "is" : "are", expired.size() == 1 ? "it" : "them"
+            ),
+            "Keep", "Delete",
+            [expired](auto*, bool btn2) {
+                if (btn2) {
+                    Trashed::purgeInBackground(expired);
+                }
+            }
+        );
+    });
+}
+
+$execute {
+    // Ask again with the new limits
+    for (auto key : { "trash-max-size", "trash-max-age", "trash-max-items" }) {
+        listenForSettingChanges(key, [](int64_t) {
+            ASKED = false;
+        });
+    }
+}
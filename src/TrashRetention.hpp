@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Mod.hpp"
+#include "core/Retention.hpp"
+
+using namespace geode::prelude;
+
+/**
+ * Keeps the trash within the limits set in the mod's settings. Which items 
+ * are over the limits is worked out in the background from the trash index 
+ * (nothing is imported), and the user is always asked before any of them 
+ * are deleted
+ */
+class TrashRetention final {
+public:
+    using ExpiredCallback = std::function<void(std::vector<Ref<Trashed>> const& expired)>;
+
+    static RetentionLimits getLimits();
+    // Find the items over the limits, oldest first. The callback is called 
+    // on the main thread
+    static void findExpired(ExpiredCallback callback);
+    // Ask whether to delete the items over the limits, if there are any. 
+    // Only asks once per session, unless the limits are changed
+    static void check();
+};
@@ -0,0 +1,535 @@
+#include "TrashStorage.hpp"
+#include "Mod.hpp"
+#include "TrashCodec.hpp"
+#include "core/WorkerPool.hpp"
+#include "core/GmdReader.hpp"
+#include "core/LevelStats.hpp"
+#include <Geode/loader/SettingV3.hpp>
+#include <Geode/utils/file.hpp>
+#include <fstream>
+
+// How many loose files to move into the archive per sync
+static constexpr size_t MIGRATE_BATCH_SIZE = 64;
+
+static Result<std::string> readFile(std::filesystem::path const& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return Err("Unable to open file");
+    }
+    return Ok(std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()));
+}
+
+// Chunked items have this set in their metadata, with the size of the whole
+// item instead of the recipe's
+static std::optional<uint64_t> getChunkedSize(PackStore::Entry const& entry) {
+    if (entry.metadata.find("\"chunked\"") == std::string::npos) {
+        return std::nullopt;
+    }
+    try {
+        auto json = matjson::parse(entry.metadata);
+        if (json.is_object() && json.contains("chunked") && json.contains("size") && json["size"].is_number()) {
+            return static_cast<uint64_t>(json["size"].as_double());
+        }
+    }
+    catch (std::exception const&) {}
+    return std::nullopt;
+}
+static std::string markChunked(std::string const& metadata, uint64_t size) {
+    auto json = matjson::Value(matjson::Object());
+    try {
+        if (metadata.size()) {
+            json = matjson::parse(metadata);
+        }
+    }
+    catch (std::exception const&) {}
+    if (!json.is_object()) {
+        json = matjson::Object();
+    }
+    json["chunked"] = true;
+    json["size"] = static_cast<double>(size);
+    return json.dump(matjson::NO_INDENTATION);
+}
+
+TrashStorage::TrashStorage() : m_pack(getTrashDir() / ".trash"), m_chunks(getTrashDir() / ".chunks") {}
+
+TrashStorage* TrashStorage::get() {
+    static auto inst = new TrashStorage();
+    return inst;
+}
+
+bool TrashStorage::isPacking() const {
+    return m_packing || m_dedup;
+}
+void TrashStorage::setPacking(bool packing) {
+    m_packing = packing;
+}
+bool TrashStorage::isDeduplicating() const {
+    return m_dedup;
+}
+void TrashStorage::setDeduplicating(bool dedup) {
+    m_dedup = dedup;
+}
+
+PackStore* TrashStorage::getPack(bool create) {
+    if (!create && !m_pack.isOpen() && !m_pack.exists()) {
+        return nullptr;
+    }
+    return m_pack.open() ? &m_pack : nullptr;
+}
+bool TrashStorage::isPackedUnder(std::filesystem::path const& path) {
+    return path.parent_path() == getTrashDir();
+}
+
+bool TrashStorage::isPacked(std::filesystem::path const& path) {
+    auto pack = this->getPack(false);
+    return pack && this->isPackedUnder(path) && pack->contains(path.filename().string());
+}
+
+bool TrashStorage::exists(std::filesystem::path const& path) {
+    std::error_code ec;
+    return std::filesystem::exists(path, ec) || this->isPacked(path);
+}
+
+std::vector<std::filesystem::path> TrashStorage::list() {
+    auto files = file::readDirectory(getTrashDir()).unwrapOrDefault();
+    if (auto pack = this->getPack(false)) {
+        for (auto& entry : pack->getEntries()) {
+            files.push_back(getTrashDir() / entry.id);
+        }
+    }
+    return files;
+}
+
+std::optional<TrashedInfo> TrashStorage::getPackedInfo(std::filesystem::path const& path) {
+    auto pack = this->getPack(false);
+    if (!pack || !this->isPackedUnder(path)) {
+        return std::nullopt;
+    }
+    auto entry = pack->getEntry(path.filename().string());
+    if (!entry || entry->metadata.empty()) {
+        return std::nullopt;
+    }
+    try {
+        auto json = matjson::parse(entry->metadata);
+        if (!matjson::Serialize<TrashedInfo>::is_json(json)) {
+            return std::nullopt;
+        }
+        auto info = matjson::Serialize<TrashedInfo>::from_json(json);
+        info.filename = entry->id;
+        info.fileSize = getChunkedSize(*entry).value_or(entry->length);
+        return info;
+    }
+    catch (std::exception const&) {
+        return std::nullopt;
+    }
+}
+
+uintmax_t TrashStorage::getFileSize(std::filesystem::path const& path) {
+    if (auto pack = this->getPack(false); pack && this->isPackedUnder(path)) {
+        if (auto entry = pack->getEntry(path.filename().string())) {
+            return getChunkedSize(*entry).value_or(entry->length);
+        }
+    }
+    std::error_code ec;
+    auto size = std::filesystem::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+void TrashStorage::countChunks() {
+    if (m_chunks.isCounted()) {
+        return;
+    }
+    std::vector<std::vector<std::string>> recipes;
+    if (auto pack = this->getPack(false)) {
+        for (auto& entry : pack->getEntries()) {
+            if (!getChunkedSize(entry)) {
+                continue;
+            }
+            auto data = pack->read(entry.id);
+            if (auto recipe = data ? ChunkRecipe::decode(*data) : std::nullopt) {
+                recipes.push_back(std::move(recipe->chunks));
+            }
+        }
+    }
+    m_chunks.count(recipes);
+    // Anything a crash left behind is unreferenced now
+    this->sweepInBackground();
+}
+
+bool TrashStorage::addToPack(PackStore* pack, std::vector<Pending>& items) {
+    std::unique_lock<std::mutex> lock;
+    std::vector<std::vector<std::string>> acquired;
+    if (m_dedup && m_chunks.open()) {
+        lock = std::unique_lock(m_chunkMutex);
+        this->countChunks();
+        for (auto& item : items) {
+            std::string plain;
+            if (item.content.starts_with(COMPRESSED_GMD_MAGIC)) {
+                auto res = decompressTrashData(item.content);
+                if (!res) {
+                    continue;
+                }
+                plain = std::move(*res);
+            }
+            else {
+                plain = item.content;
+            }
+            // Only the level string is worth chunking; anything without
+            // one (lists) is chunked whole
+            ChunkRecipe recipe;
+            std::optional<std::vector<std::string>> hashes;
+            if (auto split = splitLevelString(plain)) {
+                recipe.head = std::move(split->head);
+                recipe.tail = std::move(split->tail);
+                recipe.inflatedLevelString = split->inflated;
+                hashes = m_chunks.put(split->levelString);
+            }
+            else {
+                hashes = m_chunks.put(plain);
+            }
+            if (!hashes) {
+                continue;
+            }
+            recipe.chunks = std::move(*hashes);
+            item.content = recipe.encode();
+            item.metadata = markChunked(item.metadata, plain.size());
+            acquired.push_back(recipe.chunks);
+        }
+    }
+
+    std::vector<PackStore::Blob> blobs;
+    for (auto& item : items) {
+        blobs.push_back(PackStore::Blob { item.id, item.content, item.metadata });
+    }
+    if (!pack->add(blobs)) {
+        for (auto& hashes : acquired) {
+            m_chunks.release(hashes);
+        }
+        if (acquired.size()) {
+            this->sweepInBackground();
+        }
+        return false;
+    }
+    return true;
+}
+
+void TrashStorage::submitJob(std::function<void()> job) {
+    {
+        std::lock_guard lock(m_jobMutex);
+        m_jobCount += 1;
+    }
+    WorkerPool::get()->submit([this, job = std::move(job)] {
+        job();
+        std::lock_guard lock(m_jobMutex);
+        m_jobCount -= 1;
+        m_jobsDone.notify_all();
+    });
+}
+
+void TrashStorage::sweepInBackground() {
+    if (m_sweeping.exchange(true)) {
+        return;
+    }
+    this->submitJob([this] {
+        BETTERSAVE_PROFILE("TrashStorage::sweepChunks");
+        if (!m_chunks.sweep()) {
+            log::warn("Unable to delete unused chunks from the trash");
+        }
+        m_sweeping = false;
+    });
+}
+
+std::optional<ChunkStore::Stats> TrashStorage::getDedupStats() {
+    std::lock_guard lock(m_chunkMutex);
+    if (!m_chunks.exists() || !m_chunks.open()) {
+        return std::nullopt;
+    }
+    this->countChunks();
+    auto stats = m_chunks.getStats();
+    if (!stats.chunkCount) {
+        return std::nullopt;
+    }
+    return stats;
+}
+
+std::vector<Result<>> TrashStorage::commit(std::vector<Commit> const& commits) {
+    std::vector<Result<>> results(commits.size(), Ok());
+    auto pack = this->isPacking() ? this->getPack(true) : nullptr;
+    if (pack) {
+        std::vector<Pending> items;
+        for (size_t i = 0; i < commits.size(); i += 1) {
+            auto data = readFile(commits[i].tmp);
+            if (!data) {
+                results[i] = Err("Unable to read written file: {}", data.unwrapErr());
+                continue;
+            }
+            items.push_back(Pending { commits[i].target.filename().string(), std::move(*data), commits[i].metadata });
+        }
+        if (!this->addToPack(pack, items)) {
+            for (auto& res : results) {
+                if (res) {
+                    res = Err("Unable to add file to the packed trash");
+                }
+            }
+        }
+        for (size_t i = 0; i < commits.size(); i += 1) {
+            std::error_code ec;
+            std::filesystem::remove(commits[i].tmp, ec);
+        }
+        return results;
+    }
+
+    std::filesystem::path dir;
+    for (size_t i = 0; i < commits.size(); i += 1) {
+        std::error_code ec;
+        std::filesystem::rename(commits[i].tmp, commits[i].target, ec);
+        if (ec) {
+            results[i] = Err("Unable to move file into the trash: {} (code {})", ec.message(), ec.value());
+            std::filesystem::remove(commits[i].tmp, ec);
+        }
+        else {
+            dir = commits[i].target.parent_path();
+        }
+    }
+    // All of the renames are made durable together
+    if (!dir.empty()) {
+        syncDirectory(dir);
+    }
+    return results;
+}
+
+Result<std::filesystem::path> TrashStorage::extract(std::filesystem::path const& path, std::filesystem::path const& scratch) {
+    std::lock_guard lock(m_moveMutex);
+    if (!this->isPacked(path)) {
+        // Migrating deletes loose files once they're in the archive, which 
+        // could be before the caller is done with this one
+        if (m_migrating) {
+            std::error_code ec;
+            std::filesystem::copy_file(path, scratch, std::filesystem::copy_options::overwrite_existing, ec);
+            if (ec) {
+                return Err("Unable to copy trashed file: {} (code {})", ec.message(), ec.value());
+            }
+            return Ok(scratch);
+        }
+        return Ok(path);
+    }
+    auto data = m_pack.read(path.filename().string());
+    if (!data) {
+        return Err("Unable to read item from the packed trash");
+    }
+    if (ChunkRecipe::isRecipe(*data)) {
+        auto recipe = ChunkRecipe::decode(*data);
+        if (!recipe) {
+            return Err("Item in the packed trash is corrupted");
+        }
+        auto body = m_chunks.open() ? m_chunks.get(recipe->chunks) : std::nullopt;
+        if (!body) {
+            return Err("Unable to read the chunks of an item in the packed trash");
+        }
+        *data = recipe->head + (recipe->inflatedLevelString ? encodeLevelString(*body) : *body) + recipe->tail;
+    }
+    GEODE_UNWRAP(file::writeString(scratch, *data));
+    return Ok(scratch);
+}
+
+Result<std::string> TrashStorage::readLevelString(std::filesystem::path const& path) {
+    std::lock_guard lock(m_moveMutex);
+    if (!this->isPacked(path)) {
+        GEODE_UNWRAP_INTO(auto data, file::readString(path));
+        return readTrashedLevelString(data);
+    }
+    auto data = m_pack.read(path.filename().string());
+    if (!data) {
+        return Err("Unable to read item from the packed trash");
+    }
+    if (!ChunkRecipe::isRecipe(*data)) {
+        return readTrashedLevelString(*data);
+    }
+    auto recipe = ChunkRecipe::decode(*data);
+    if (!recipe) {
+        return Err("Item in the packed trash is corrupted");
+    }
+    auto body = m_chunks.open() ? m_chunks.get(recipe->chunks) : std::nullopt;
+    if (!body) {
+        return Err("Unable to read the chunks of an item in the packed trash");
+    }
+    // The chunks are the level string itself
+    if (recipe->inflatedLevelString) {
+        return Ok(std::move(*body));
+    }
+    auto decoded = decodeLevelString(*body);
+    if (!decoded) {
+        return Err("Level string is corrupted");
+    }
+    return Ok(std::move(*decoded));
+}
+
+std::vector<Result<>> TrashStorage::remove(std::vector<std::filesystem::path> const& paths) {
+    std::lock_guard moveLock(m_moveMutex);
+    std::vector<Result<>> results(paths.size(), Ok());
+    std::vector<size_t> packed;
+    for (size_t i = 0; i < paths.size(); i += 1) {
+        if (this->isPacked(paths[i])) {
+            packed.push_back(i);
+            continue;
+        }
+        std::error_code ec;
+        std::filesystem::remove(paths[i], ec);
+        if (ec) {
+            results[i] = Err("Unable to delete trashed file: {} (code {})", ec.message(), ec.value());
+        }
+    }
+    if (packed.size()) {
+        std::vector<std::string> ids;
+        bool chunked = false;
+        for (auto i : packed) {
+            ids.push_back(paths[i].filename().string());
+            auto entry = m_pack.getEntry(ids.back());
+            chunked = chunked || (entry && getChunkedSize(*entry));
+        }
+        // The recipes' chunks can only be let go of once the recipes are gone
+        std::unique_lock<std::mutex> lock;
+        std::vector<std::string> released;
+        if (chunked && m_chunks.open()) {
+            lock = std::unique_lock(m_chunkMutex);
+            this->countChunks();
+            for (auto& id : ids) {
+                auto data = m_pack.read(id);
+                if (auto recipe = data ? ChunkRecipe::decode(*data) : std::nullopt) {
+                    released.insert(released.end(), recipe->chunks.begin(), recipe->chunks.end());
+                }
+            }
+        }
+        if (!m_pack.remove(ids)) {
+            for (auto i : packed) {
+                results[i] = Err("Unable to delete item from the packed trash");
+            }
+        }
+        else if (released.size()) {
+            m_chunks.release(released);
+            this->sweepInBackground();
+        }
+        this->compactIfNeeded();
+    }
+    return results;
+}
+
+Result<> TrashStorage::clear() {
+    // Migrating stops after its current batch
+    m_clearing = true;
+    {
+        std::unique_lock lock(m_jobMutex);
+        m_jobsDone.wait(lock, [this] { return m_jobCount == 0; });
+    }
+    std::lock_guard moveLock(m_moveMutex);
+    std::lock_guard lock(m_chunkMutex);
+    m_pack.close();
+    m_chunks.close();
+    m_clearing = false;
+    std::error_code ec;
+    std::filesystem::remove_all(getTrashDir(), ec);
+    if (ec) {
+        return Err("{} (code {})", ec.message(), ec.value());
+    }
+    return Ok();
+}
+
+void TrashStorage::compactIfNeeded() {
+    if (!m_pack.isOpen() || !m_pack.shouldCompact() || m_compacting.exchange(true)) {
+        return;
+    }
+    this->submitJob([this] {
+        BETTERSAVE_PROFILE("TrashStorage::compact");
+        if (!m_pack.compact()) {
+            log::warn("Unable to compact the packed trash");
+        }
+        m_compacting = false;
+    });
+}
+
+void TrashStorage::migrate(std::vector<TrashedInfo> const& infos) {
+    if (!this->isPacking() || m_migrating.exchange(true)) {
+        return;
+    }
+    std::unordered_map<std::string, std::string> metadata;
+    for (auto& info : infos) {
+        metadata.insert({ info.filename, matjson::Serialize<TrashedInfo>::to_json(info).dump(matjson::NO_INDENTATION) });
+    }
+    this->submitJob([this, metadata = std::move(metadata)] {
+        BETTERSAVE_PROFILE("TrashStorage::migrate");
+        auto pack = this->getPack(true);
+        if (!pack) {
+            log::warn("Unable to open the packed trash for moving files into it");
+            m_migrating = false;
+            return;
+        }
+        std::vector<std::filesystem::path> files;
+        for (auto& file : file::readDirectory(getTrashDir()).unwrapOrDefault()) {
+            if (!file.filename().string().starts_with(".")) {
+                files.push_back(file);
+            }
+        }
+        size_t moved = 0;
+        for (size_t start = 0; start < files.size() && this->isPacking() && !m_clearing; start += MIGRATE_BATCH_SIZE) {
+            auto end = std::min(start + MIGRATE_BATCH_SIZE, files.size());
+            std::lock_guard lock(m_moveMutex);
+            std::vector<Pending> items;
+            std::vector<std::filesystem::path> batch;
+            for (size_t i = start; i < end; i += 1) {
+                auto data = readFile(files[i]);
+                if (!data) {
+                    continue;
+                }
+                auto id = files[i].filename().string();
+                auto meta = metadata.find(id);
+                items.push_back(Pending { id, std::move(*data), meta != metadata.end() ? meta->second : "" });
+                batch.push_back(files[i]);
+            }
+            if (!this->addToPack(pack, items)) {
+                log::warn("Unable to move files into the packed trash");
+                break;
+            }
+            // A file that's already gone was restored or deleted while it
+            // was being copied, so it mustn't come back from the archive
+            std::vector<std::string> vanished;
+            for (auto& file : batch) {
+                std::error_code ec;
+                if (!std::filesystem::remove(file, ec) && !ec) {
+                    vanished.push_back(file.filename().string());
+                }
+            }
+            pack->remove(vanished);
+            moved += batch.size() - vanished.size();
+        }
+        syncDirectory(getTrashDir());
+        if (moved) {
+            log::info("Moved {} trashed files into the packed trash", moved);
+        }
+        m_migrating = false;
+    });
+}
+
+// Move the trash into the archive once it's been turned on. Before the trash
+// has been loaded, loading it starts the move instead
+static void migrateIfLoaded() {
+    if (TrashStorage::get()->isPacking() && TrashIndex::get()->isReconciled()) {
+        std::vector<TrashedInfo> infos;
+        for (auto& [_, info] : TrashIndex::get()->getEntries()) {
+            infos.push_back(info);
+        }
+        TrashStorage::get()->migrate(infos);
+    }
+}
+
+$execute {
+    TrashStorage::get()->setPacking(Mod::get()->getSettingValue<bool>("pack-trash"));
+    TrashStorage::get()->setDeduplicating(Mod::get()->getSettingValue<bool>("dedup-trash"));
+    listenForSettingChanges("pack-trash", [](bool packing) {
+        TrashStorage::get()->setPacking(packing);
+        migrateIfLoaded();
+    });
+    listenForSettingChanges("dedup-trash", [](bool dedup) {
+        TrashStorage::get()->setDeduplicating(dedup);
+        migrateIfLoaded();
+    });
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include <Geode/utils/cocos.hpp>
+#include "TrashIndex.hpp"
+#include "core/PackStore.hpp"
+#include "core/ChunkStore.hpp"
+
+using namespace geode::prelude;
+
+/**
+ * Where the files of trashed items actually live. Normally every item is its
+ * own file in the trash directory, but with the Packed Trash setting on, new
+ * items are appended to a single PackStore archive in the directory instead
+ * and loose files are moved into it in the background. Listing the archive
+ * only reads its memory-mapped index, which is a lot cheaper than opening
+ * every file on Android's scoped storage or with antivirus in the way.
+ *
+ * With the Deduplicate Trash setting on, items in the archive are stored as
+ * recipes instead: the level string is split into content-defined chunks
+ * that go into a ChunkStore next to the archive, so revisions of the same
+ * level share most of their data. Recipes are rebuilt into whole items when
+ * they're extracted, and chunks nothing uses anymore are swept in the
+ * background.
+ *
+ * Items keep their filenames either way, so the rest of the trash code deals
+ * in paths; those of packed items just don't exist on disk. Everything here
+ * is safe to call from any thread
+ */
+class TrashStorage final {
+public:
+    struct Commit final {
+        // A finished, synced temp file
+        std::filesystem::path tmp;
+        std::filesystem::path target;
+        // Serialized TrashedInfo, stored with packed items
+        std::string metadata;
+    };
+
+protected:
+    PackStore m_pack;
+    std::atomic_bool m_packing = false;
+    std::atomic_bool m_migrating = false;
+    std::atomic_bool m_compacting = false;
+    // Held while loose files are moved into the archive, and while items 
+    // are looked up to be read or removed, so nothing sees an item halfway 
+    // through moving
+    std::mutex m_moveMutex;
+    // Background jobs (migrating, compacting, sweeping) still running, which 
+    // clear has to wait for before pulling the files out from under them
+    std::mutex m_jobMutex;
+    std::condition_variable m_jobsDone;
+    size_t m_jobCount = 0;
+    std::atomic_bool m_clearing = false;
+
+    ChunkStore m_chunks;
+    // Held while chunked items are added or removed, so the chunks' reference
+    // counts always match the recipes in the archive
+    std::mutex m_chunkMutex;
+    std::atomic_bool m_dedup = false;
+    std::atomic_bool m_sweeping = false;
+
+    struct Pending final {
+        std::string id;
+        std::string content;
+        std::string metadata;
+    };
+
+    TrashStorage();
+
+    void submitJob(std::function<void()> job);
+    // Add items to the archive, turning them into recipes first if
+    // deduplicating
+    bool addToPack(PackStore* pack, std::vector<Pending>& items);
+    // Count the chunks' references if that hasn't been done yet. Must hold
+    // m_chunkMutex
+    void countChunks();
+    void sweepInBackground();
+
+    // The archive, or null if it doesn't exist (and `create` isn't set) or
+    // can't be opened
+    PackStore* getPack(bool create);
+    bool isPackedUnder(std::filesystem::path const& path);
+    void compactIfNeeded();
+
+public:
+    static TrashStorage* get();
+
+    // Whether new items go into the archive. Set from the main thread
+    bool isPacking() const;
+    void setPacking(bool packing);
+    // Whether new items in the archive are split into shared chunks (which
+    // implies packing them)
+    bool isDeduplicating() const;
+    void setDeduplicating(bool dedup);
+    // How well the chunks are being shared, or nullopt if nothing has been
+    // deduplicated. Reads every recipe the first time, so call it from a
+    // worker thread
+    std::optional<ChunkStore::Stats> getDedupStats();
+
+    bool isPacked(std::filesystem::path const& path);
+    // Whether the item is in the trash, packed or not
+    bool exists(std::filesystem::path const& path);
+    // Every item in the trash: the files in the directory and the items in
+    // the archive
+    std::vector<std::filesystem::path> list();
+    std::optional<TrashedInfo> getPackedInfo(std::filesystem::path const& path);
+    uintmax_t getFileSize(std::filesystem::path const& path);
+
+    // Move finished temp files into the trash, either by renaming them into
+    // place or by appending them to the archive all at once
+    std::vector<Result<>> commit(std::vector<Commit> const& commits);
+    // Get a readable file with the item's contents, writing packed items out
+    // into `scratch`. Returns the item's own path if it isn't packed, unless 
+    // it might be moved into the archive at any moment, in which case it's 
+    // copied into `scratch` too
+    Result<std::filesystem::path> extract(std::filesystem::path const& path, std::filesystem::path const& scratch);
+    // The decoded level string of a trashed level, without writing anything 
+    // out. Safe to call from a worker thread
+    Result<std::string> readLevelString(std::filesystem::path const& path);
+    std::vector<Result<>> remove(std::vector<std::filesystem::path> const& paths);
+    // Delete the whole trash, archive included. Waits for background jobs 
+    // to finish first
+    Result<> clear();
+
+    // Move loose files into the archive in the background. `infos` has the
+    // metadata to store with them (from the trash index); main thread only
+    void migrate(std::vector<TrashedInfo> const& infos);
+};
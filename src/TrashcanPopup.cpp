@@ -1,6 +1,25 @@
 #include "TrashcanPopup.hpp"
+#include "TrashStorage.hpp"
+#include "TrashQueue.hpp"
+#include "core/WorkerPool.hpp"
 #include <Geode/ui/ScrollLayer.hpp>
 #include <fmt/chrono.h>
+#include <unordered_set>
+
+// Case-insensitive (ASCII) comparison of item names
+static int compareNames(std::string_view a, std::string_view b) {
+    auto const lower = [](char c) {
+        return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+    };
+    for (size_t i = 0; i < a.size() && i < b.size(); i += 1) {
+        auto ca = lower(a[i]);
+        auto cb = lower(b[i]);
+        if (ca != cb) {
+            return static_cast<unsigned char>(ca) < static_cast<unsigned char>(cb) ? -1 : 1;
+        }
+    }
+    return a.size() == b.size() ? 0 : (a.size() < b.size() ? -1 : 1);
+}
 
 static std::string toAgoString(Trashed::TimePoint const& time) {
     auto const fmtPlural = [](auto count, auto unit) {
@@ -27,7 +46,131 @@ static std::string toAgoString(Trashed::TimePoint const& time) {
     return fmt::format("{:%b %d %Y}", time - Trashed::Clock::now() + std::chrono::system_clock::now());
 }
 
+static const char* getSortName(TrashcanSort sort) {
+    switch (sort) {
+        case TrashcanSort::Newest: return "Newest";
+        case TrashcanSort::Oldest: return "Oldest";
+        case TrashcanSort::Name: return "Name";
+        case TrashcanSort::Largest: return "Largest";
+        case TrashcanSort::MostObjects: return "Objects";
+    }
+    return "";
+}
+static const char* getFilterName(TrashcanFilter filter) {
+    switch (filter) {
+        case TrashcanFilter::All: return "All";
+        case TrashcanFilter::Levels: return "Levels";
+        case TrashcanFilter::Lists: return "Lists";
+    }
+    return "";
+}
+
+static constexpr float ROW_HEIGHT = 38;
+// How many rows to keep around beyond the ones in view, so scrolling doesn't 
+// reveal rows before they're filled in
+static constexpr size_t ROW_OVERSCAN = 2;
+
+class TrashcanRow : public CCNode {
+protected:
+    CCMenuItemToggler* m_selectToggle;
+    CCLabelBMFont* m_title;
+    CCLabelBMFont* m_trashTime;
+    CCMenuItemSpriteExtra* m_restoreBtn;
+    CCMenuItemSpriteExtra* m_deleteBtn;
+    CCMenuItemSpriteExtra* m_infoBtn;
+
+    bool init(TrashcanPopup* popup, float width) {
+        if (!CCNode::init())
+            return false;
+
+        this->setContentSize({ width, ROW_HEIGHT });
+        this->setAnchorPoint({ 0, 0 });
+
+        auto separator = CCLayerColor::create({ 0, 0, 0, 90 }, width, 1);
+        separator->ignoreAnchorPointForPosition(false);
+        separator->setOpacity(90);
+        this->addChildAtPosition(separator, Anchor::Bottom);
+
+        auto selectMenu = CCMenu::create();
+        selectMenu->setContentSize({ 30, ROW_HEIGHT });
+        m_selectToggle = CCMenuItemToggler::createWithStandardSprites(
+            popup, menu_selector(TrashcanPopup::onSelect), .6f
+        );
+        selectMenu->addChildAtPosition(m_selectToggle, Anchor::Center);
+        this->addChildAtPosition(selectMenu, Anchor::Left, ccp(5, 0));
+
+        m_title = CCLabelBMFont::create("", "bigFont.fnt");
+        m_title->setScale(.5f);
+        m_title->setAnchorPoint({ 0, .5f });
+        this->addChildAtPosition(m_title, Anchor::Left, ccp(35, 8));
+
+        m_trashTime = CCLabelBMFont::create("", "goldFont.fnt");
+        m_trashTime->setScale(.4f);
+        m_trashTime->setAnchorPoint({ 0, .5f });
+        this->addChildAtPosition(m_trashTime, Anchor::Left, ccp(35, -8));
+
+        auto actionsMenu = CCMenu::create();
+        actionsMenu->setContentWidth(width / 2);
+
+        auto restoreSpr = CCSprite::createWithSpriteFrameName("GJ_undoBtn_001.png");
+        m_restoreBtn = CCMenuItemSpriteExtra::create(
+            restoreSpr, popup, menu_selector(TrashcanPopup::onRestore)
+        );
+        actionsMenu->addChild(m_restoreBtn);
+
+        auto deleteSpr = CCSprite::createWithSpriteFrameName("GJ_trashBtn_001.png");
+        m_deleteBtn = CCMenuItemSpriteExtra::create(
+            deleteSpr, popup, menu_selector(TrashcanPopup::onDelete)
+        );
+        m_deleteBtn->setLayoutOptions(AxisLayoutOptions::create()->setRelativeScale(.95f));
+        actionsMenu->addChild(m_deleteBtn);
+
+        auto infoSpr = CCSprite::createWithSpriteFrameName("GJ_infoIcon_001.png");
+        m_infoBtn = CCMenuItemSpriteExtra::create(
+            infoSpr, popup, menu_selector(TrashcanPopup::onInfo)
+        );
+        actionsMenu->addChild(m_infoBtn);
+
+        // The buttons are the same for every item, so this only ever has to 
+        // be laid out once
+        actionsMenu->setLayout(
+            RowLayout::create()
+                ->setAxisAlignment(AxisAlignment::End)
+                ->setAxisReverse(true)
+                ->setDefaultScaleLimits(.1f, .65f)
+                ->setGap(10)
+        );
+        actionsMenu->setAnchorPoint({ 1, .5f });
+        this->addChildAtPosition(actionsMenu, Anchor::Right, ccp(-10, 0));
+
+        return true;
+    }
+
+public:
+    static TrashcanRow* create(TrashcanPopup* popup, float width) {
+        auto ret = new TrashcanRow();
+        if (ret && ret->init(popup, width)) {
+            ret->autorelease();
+            return ret;
+        }
+        CC_SAFE_DELETE(ret);
+        return nullptr;
+    }
+
+    void setItem(Trashed* item, bool selected) {
+        m_selectToggle->toggle(selected);
+        m_selectToggle->setUserObject(item);
+        m_title->setString(item->getName().c_str());
+        m_title->setColor(item->isList() ? ccColor3B { 0, 255, 0 } : ccWHITE);
+        m_trashTime->setString(fmt::format("Trashed {}", toAgoString(item->getTrashTime())).c_str());
+        m_restoreBtn->setUserObject(item);
+        m_deleteBtn->setUserObject(item);
+        m_infoBtn->setUserObject(item);
+    }
+};
+
 bool TrashcanPopup::setup() {
+    BETTERSAVE_PROFILE("TrashcanPopup::setup");
     this->setTitle("Trashcan");
 
     auto trashcanSpr = CCSprite::createWithSpriteFrameName("edit_delBtn_001.png");
@@ -35,18 +178,45 @@ bool TrashcanPopup::setup() {
     m_mainLayer->addChildAtPosition(trashcanSpr, Anchor::Top, ccp(-55, -20));
 
     m_scrollingLayer = ScrollLayer::create({ 300, 200 });
-    m_scrollingLayer->m_contentLayer->setLayout(
-        ColumnLayout::create()
-            ->setAxisReverse(true)
-            ->setAutoGrowAxis(m_scrollingLayer->getContentHeight())
-            ->setAxisAlignment(AxisAlignment::End)
-            ->setGap(0)
-    );
-    m_mainLayer->addChildAtPosition(m_scrollingLayer, Anchor::Center, -m_scrollingLayer->getContentSize() / 2);
+    m_mainLayer->addChildAtPosition(m_scrollingLayer, Anchor::Center, ccp(0, -15) - m_scrollingLayer->getContentSize() / 2);
 
     auto border = ListBorders::create();
     border->setContentSize(m_scrollingLayer->getContentSize());
-    m_mainLayer->addChildAtPosition(border, Anchor::Center);
+    m_mainLayer->addChildAtPosition(border, Anchor::Center, ccp(0, -15));
+
+    m_noMatchesLabel = CCLabelBMFont::create("No matching items", "bigFont.fnt");
+    m_noMatchesLabel->setScale(.5f);
+    m_noMatchesLabel->setVisible(false);
+    m_mainLayer->addChildAtPosition(m_noMatchesLabel, Anchor::Center, ccp(0, -15));
+
+    m_dedupLabel = CCLabelBMFont::create("", "goldFont.fnt");
+    m_dedupLabel->setScale(.45f);
+    m_dedupLabel->setAnchorPoint({ 1, .5f });
+    m_mainLayer->addChildAtPosition(m_dedupLabel, Anchor::TopRight, ccp(-12, -18));
+
+    m_searchInput = TextInput::create(170, "Search...");
+    m_searchInput->setScale(.8f);
+    m_searchInput->setCommonFilter(CommonFilter::Any);
+    m_searchInput->setCallback([this](std::string const& query) {
+        m_query = query;
+        this->updateList();
+        this->updateSelection();
+    });
+    m_mainLayer->addChildAtPosition(m_searchInput, Anchor::Top, ccp(-82, -50));
+
+    m_sortSpr = ButtonSprite::create(getSortName(m_sort), 70, true, "goldFont.fnt", "GJ_button_04.png", 25, .7f);
+    m_sortSpr->setScale(.6f);
+    auto sortBtn = CCMenuItemSpriteExtra::create(
+        m_sortSpr, this, menu_selector(TrashcanPopup::onSort)
+    );
+    m_buttonMenu->addChildAtPosition(sortBtn, Anchor::Top, ccp(50, -50));
+
+    m_filterSpr = ButtonSprite::create(getFilterName(m_filter), 70, true, "goldFont.fnt", "GJ_button_04.png", 25, .7f);
+    m_filterSpr->setScale(.6f);
+    auto filterBtn = CCMenuItemSpriteExtra::create(
+        m_filterSpr, this, menu_selector(TrashcanPopup::onFilter)
+    );
+    m_buttonMenu->addChildAtPosition(filterBtn, Anchor::Top, ccp(115, -50));
 
     auto deleteAllSpr = CCSprite::createWithSpriteFrameName("GJ_resetBtn_001.png");
     auto deleteAllBtn = CCMenuItemSpriteExtra::create(
@@ -54,108 +224,356 @@ bool TrashcanPopup::setup() {
     );
     m_buttonMenu->addChildAtPosition(deleteAllBtn, Anchor::BottomLeft, ccp(20, 20));
 
-    m_listener.bind([this](auto*) {
-        this->updateList();
+    m_selectAllSpr = ButtonSprite::create("Select All", "goldFont.fnt", "GJ_button_04.png", .8f);
+    m_selectAllSpr->setScale(.55f);
+    auto selectAllBtn = CCMenuItemSpriteExtra::create(
+        m_selectAllSpr, this, menu_selector(TrashcanPopup::onSelectAll)
+    );
+    m_buttonMenu->addChildAtPosition(selectAllBtn, Anchor::Bottom, ccp(-75, 18));
+
+    m_restoreSelectedSpr = ButtonSprite::create("Restore", "goldFont.fnt", "GJ_button_01.png", .8f);
+    m_restoreSelectedSpr->setScale(.55f);
+    m_restoreSelectedBtn = CCMenuItemSpriteExtra::create(
+        m_restoreSelectedSpr, this, menu_selector(TrashcanPopup::onRestoreSelected)
+    );
+    m_buttonMenu->addChildAtPosition(m_restoreSelectedBtn, Anchor::Bottom, ccp(15, 18));
+
+    m_deleteSelectedSpr = ButtonSprite::create("Delete", "goldFont.fnt", "GJ_button_06.png", .8f);
+    m_deleteSelectedSpr->setScale(.55f);
+    m_deleteSelectedBtn = CCMenuItemSpriteExtra::create(
+        m_deleteSelectedSpr, this, menu_selector(TrashcanPopup::onDeleteSelected)
+    );
+    m_buttonMenu->addChildAtPosition(m_deleteSelectedBtn, Anchor::Bottom, ccp(100, 18));
+    this->updateSelection();
+
+    m_loadingCircle = CCSprite::create("loadingCircle.png");
+    m_loadingCircle->setBlendFunc({ GL_SRC_ALPHA, GL_ONE });
+    m_loadingCircle->setScale(.5f);
+    m_loadingCircle->runAction(CCRepeatForever::create(CCRotateBy::create(1, 360)));
+    m_mainLayer->addChildAtPosition(m_loadingCircle, Anchor::Center, ccp(0, -15));
+
+    m_listener.bind([this](UpdateTrashEvent* event) {
+        this->applyUpdate(event);
         return ListenerResult::Propagate;
     });
-    this->updateList();
+    Trashed::loadAsync([self = Ref(this)](auto const& items, bool done) {
+        self->onLoaded(items, done);
+    });
+    // Counting the chunks reads every recipe in the archive the first time.
+    // The popup is only retained and released on the main thread
+    WorkerPool::get()->submit([self = Ref(this)]() mutable {
+        auto stats = TrashStorage::get()->getDedupStats();
+        Loader::get()->queueInMainThread([self = std::move(self), stats] {
+            if (stats && !self->m_closed) {
+                self->m_dedupLabel->setString(fmt::format("{:.1f}x deduplicated", stats->getRatio()).c_str());
+            }
+        });
+    });
+    this->scheduleUpdate();
     
     return true;
 }
 
-void TrashcanPopup::updateList() {
-    m_scrollingLayer->m_contentLayer->removeAllChildren();
-    auto items = Trashed::load();
-    if (items.empty()) {
-        return this->onClose(nullptr);
+void TrashcanPopup::update(float) {
+    this->updateVisibleRows(false);
+}
+
+void TrashcanPopup::insertItems(std::vector<Ref<Trashed>> const& items) {
+    // Keep the same order as Trashed::load, and skip items that both the 
+    // loader and an update event delivered
+    for (auto& item : items) {
+        auto pos = std::lower_bound(m_items.begin(), m_items.end(), item, [](auto const& a, auto const& b) {
+            return a->getInfo().filename < b->getInfo().filename;
+        });
+        if (pos == m_items.end() || (*pos)->getInfo().filename != item->getInfo().filename) {
+            m_items.insert(pos, item);
+            m_searchIDs.insert({ item->getInfo().filename, m_search.add(item->getName()) });
+            m_searchDocs.push_back(item);
+        }
+    }
+}
+void TrashcanPopup::removeItems(std::unordered_set<std::string> const& filenames) {
+    std::erase_if(m_items, [&](auto const& item) {
+        return filenames.contains(item->getInfo().filename);
+    });
+    for (auto& filename : filenames) {
+        m_selected.erase(filename);
+        if (auto it = m_searchIDs.find(filename); it != m_searchIDs.end()) {
+            m_search.remove(it->second);
+            m_searchDocs[it->second] = nullptr;
+            m_searchIDs.erase(it);
+        }
     }
-    for (auto gmd : items) {
-        auto node = CCNode::create();
-        node->setContentSize({ m_scrollingLayer->getContentWidth(), 38 });
+}
 
-        auto separator = CCLayerColor::create({ 0, 0, 0, 90 }, node->getContentWidth(), 1);
-        separator->ignoreAnchorPointForPosition(false);
-        separator->setOpacity(90);
-        node->addChildAtPosition(separator, Anchor::Bottom);
+void TrashcanPopup::onLoaded(std::vector<Ref<Trashed>> const& items, bool done) {
+    // The popup may have been closed while loading
+    if (m_closed) {
+        return;
+    }
+    this->insertItems(items);
+    if (done && m_loadingCircle) {
+        m_loadingCircle->removeFromParent();
+        m_loadingCircle = nullptr;
+    }
+    this->updateList();
+    this->updateSelection();
+}
+
+void TrashcanPopup::applyUpdate(UpdateTrashEvent* event) {
+    if (event->cleared) {
+        m_items.clear();
+        m_selected.clear();
+        m_search.clear();
+        m_searchDocs.clear();
+        m_searchIDs.clear();
+    }
+    if (event->removed.size()) {
+        this->removeItems(std::unordered_set<std::string>(event->removed.begin(), event->removed.end()));
+    }
+    this->insertItems(event->added);
+    this->updateList();
+    this->updateSelection();
+}
 
-        auto title = CCLabelBMFont::create(gmd->getName().c_str(), "bigFont.fnt");
-        title->setScale(.5f);
-        title->setAnchorPoint({ 0, .5f });
-        if (gmd->asList()) {
-            title->setColor({ 0, 255, 0 });
+void TrashcanPopup::updateShown() {
+    BETTERSAVE_PROFILE("TrashcanPopup::updateShown");
+    struct Shown final {
+        Trashed* item;
+        bool prefix;
+    };
+    std::vector<Shown> shown;
+    for (auto& match : m_search.search(m_query)) {
+        auto item = m_searchDocs[match.id];
+        if (
+            (m_filter == TrashcanFilter::Levels && !item->isLevel()) ||
+            (m_filter == TrashcanFilter::Lists && !item->isList())
+        ) {
+            continue;
         }
-        node->addChildAtPosition(title, Anchor::Left, ccp(10, 8));
+        shown.push_back(Shown { item, match.prefix });
+    }
 
-        auto objCount = CCLabelBMFont::create(fmt::format("Trashed {}", toAgoString(gmd->getTrashTime())).c_str(), "goldFont.fnt");
-        objCount->setScale(.4f);
-        objCount->setAnchorPoint({ 0, .5f });
-        node->addChildAtPosition(objCount, Anchor::Left, ccp(10, -8));
+    // Names that start with the query come first when searching
+    std::sort(shown.begin(), shown.end(), [this](Shown const& a, Shown const& b) {
+        if (a.prefix != b.prefix) {
+            return a.prefix;
+        }
+        auto& ai = a.item->getInfo();
+        auto& bi = b.item->getInfo();
+        switch (m_sort) {
+            case TrashcanSort::Newest: {
+                if (ai.trashTime != bi.trashTime) return ai.trashTime > bi.trashTime;
+            } break;
+            case TrashcanSort::Oldest: {
+                if (ai.trashTime != bi.trashTime) return ai.trashTime < bi.trashTime;
+            } break;
+            case TrashcanSort::Largest: {
+                if (ai.fileSize != bi.fileSize) return ai.fileSize > bi.fileSize;
+            } break;
+            case TrashcanSort::MostObjects: {
+                if (ai.objectCount != bi.objectCount) return ai.objectCount > bi.objectCount;
+            } break;
+            case TrashcanSort::Name: {
+                auto cmp = compareNames(ai.name, bi.name);
+                if (cmp != 0) return cmp < 0;
+            } break;
+        }
+        return ai.filename < bi.filename;
+    });
 
-        auto actionsMenu = CCMenu::create();
-        actionsMenu->setContentWidth(m_scrollingLayer->getContentWidth() / 2);
+    m_shown.clear();
+    m_shown.reserve(shown.size());
+    for (auto& item : shown) {
+        m_shown.push_back(item.item);
+    }
+}
 
-        auto restoreSpr = CCSprite::createWithSpriteFrameName("GJ_undoBtn_001.png");
-        auto restoreBtn = CCMenuItemSpriteExtra::create(
-            restoreSpr, this, menu_selector(TrashcanPopup::onRestore)
-        );
-        restoreBtn->setUserObject(gmd);
-        actionsMenu->addChild(restoreBtn);
+void TrashcanPopup::updateList() {
+    BETTERSAVE_PROFILE("TrashcanPopup::updateList");
+    if (m_items.empty()) {
+        m_shown.clear();
+        // Only close once we know the trash is actually empty
+        if (!m_loadingCircle) {
+            this->onClose(nullptr);
+        }
+        return;
+    }
+    this->updateShown();
+    m_noMatchesLabel->setVisible(m_shown.empty() && !m_loadingCircle);
 
-        auto deleteSpr = CCSprite::createWithSpriteFrameName("GJ_trashBtn_001.png");
-        auto deleteBtn = CCMenuItemSpriteExtra::create(
-            deleteSpr, this, menu_selector(TrashcanPopup::onDelete)
-        );
-        deleteBtn->setLayoutOptions(AxisLayoutOptions::create()->setRelativeScale(.95f));
-        deleteBtn->setUserObject(gmd);
-        actionsMenu->addChild(deleteBtn);
+    // Resize the content layer to fit all of the items while keeping the 
+    // same distance from the top so refreshing doesn't jump around
+    auto content = m_scrollingLayer->m_contentLayer;
+    auto viewHeight = m_scrollingLayer->getContentHeight();
+    auto fromTop = content->getPositionY() - (viewHeight - content->getContentHeight());
+    auto height = std::max(viewHeight, m_shown.size() * ROW_HEIGHT);
+    content->setContentSize({ m_scrollingLayer->getContentWidth(), height });
+    content->setPositionY(std::clamp(viewHeight - height + fromTop, viewHeight - height, 0.f));
 
-        auto infoSpr = CCSprite::createWithSpriteFrameName("GJ_infoIcon_001.png");
-        auto infoBtn = CCMenuItemSpriteExtra::create(
-            infoSpr, this, menu_selector(TrashcanPopup::onInfo)
-        );
-        infoBtn->setUserObject(gmd);
-        actionsMenu->addChild(infoBtn);
+    this->updateVisibleRows(true);
+}
 
-        actionsMenu->setLayout(
-            RowLayout::create()
-                ->setAxisAlignment(AxisAlignment::End)
-                ->setAxisReverse(true)
-                ->setDefaultScaleLimits(.1f, .65f)
-                ->setGap(10)
-        );
-        actionsMenu->setAnchorPoint({ 1, .5f });
-        node->addChildAtPosition(actionsMenu, Anchor::Right, ccp(-10, 0));
-        
-        m_scrollingLayer->m_contentLayer->addChild(node);
+void TrashcanPopup::updateVisibleRows(bool force) {
+    auto content = m_scrollingLayer->m_contentLayer;
+    auto height = content->getContentHeight();
+
+    // Rows are ordered from the top of the content layer, so figure out which 
+    // ones overlap the scrolled-to window
+    auto viewBottom = -content->getPositionY();
+    auto viewTop = viewBottom + m_scrollingLayer->getContentHeight();
+    auto first = static_cast<size_t>(std::max(0.f, (height - viewTop) / ROW_HEIGHT));
+    auto last = static_cast<size_t>(std::max(0.f, (height - viewBottom) / ROW_HEIGHT)) + 1;
+    first = first > ROW_OVERSCAN ? first - ROW_OVERSCAN : 0;
+    last = std::min(last + ROW_OVERSCAN, m_shown.size());
+
+    if (!force && first == m_firstVisibleRow && last == m_lastVisibleRow) {
+        return;
+    }
+    m_firstVisibleRow = first;
+    m_lastVisibleRow = last;
+
+    // Recycle rows that went out of view (or all of them if the items changed)
+    for (auto it = m_visibleRows.begin(); it != m_visibleRows.end();) {
+        if (force || it->first < first || it->first >= last) {
+            it->second->setVisible(false);
+            m_freeRows.push_back(it->second);
+            it = m_visibleRows.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    bool createdRows = false;
+    for (size_t i = first; i < last; i += 1) {
+        if (m_visibleRows.contains(i)) {
+            continue;
+        }
+        TrashcanRow* row;
+        if (m_freeRows.size()) {
+            row = m_freeRows.back();
+            m_freeRows.pop_back();
+        }
+        else {
+            row = TrashcanRow::create(this, m_scrollingLayer->getContentWidth());
+            content->addChild(row);
+            createdRows = true;
+        }
+        row->setItem(m_shown[i], m_selected.contains(m_shown[i]->getInfo().filename));
+        row->setPosition(0, height - (i + 1) * ROW_HEIGHT);
+        row->setVisible(true);
+        m_visibleRows.insert({ i, row });
+    }
+
+    // New buttons need their touch priority fixed. This is also because 
+    // updating the LevelBrowserLayer underneath causes it to take touch 
+    // priority
+    if (createdRows || force) {
+        handleTouchPriority(this);
+    }
+}
+
+void TrashcanPopup::updateSelection() {
+    auto count = m_selected.size();
+    m_selectAllSpr->setString(this->isAllShownSelected() ? "Select None" : "Select All");
+    m_restoreSelectedSpr->setString(fmt::format("Restore ({})", count).c_str());
+    m_deleteSelectedSpr->setString(fmt::format("Delete ({})", count).c_str());
+    m_restoreSelectedBtn->setVisible(count > 0);
+    m_deleteSelectedBtn->setVisible(count > 0);
+}
+bool TrashcanPopup::isAllShownSelected() const {
+    return m_shown.size() && std::all_of(m_shown.begin(), m_shown.end(), [this](auto item) {
+        return m_selected.contains(item->getInfo().filename);
+    });
+}
+std::vector<Ref<Trashed>> TrashcanPopup::getSelectedItems() const {
+    // Keep the order they're shown in
+    std::vector<Ref<Trashed>> items;
+    for (auto& item : m_items) {
+        if (m_selected.contains(item->getInfo().filename)) {
+            items.push_back(item);
+        }
     }
-    m_scrollingLayer->m_contentLayer->updateLayout();
+    return items;
+}
+
+void TrashcanPopup::onClose(CCObject* sender) {
+    m_closed = true;
+    Popup::onClose(sender);
+}
 
-    // This is because updating the LevelBrowserLayer underneath causes it to take touch priority
-    handleTouchPriority(this);
+static void showLevelInfo(TrashedInfo const& info) {
+    auto details = std::string();
+    if (info.stats) {
+        auto& stats = *info.stats;
+        details = fmt::format(
+            "<cy>Triggers</c>: {}\n"
+            "<cg>Groups</c>: {} ({} objects grouped)\n"
+            "<cl>Level Data</c>: {:.1f} KB\n",
+            stats.triggerCount,
+            stats.groupCount, stats.groupedObjects,
+            stats.decodedSize / 1024.0
+        );
+        if (stats.objectsByID.size()) {
+            details += "<cj>Most Used IDs</c>: ";
+            for (size_t i = 0; i < stats.objectsByID.size(); i += 1) {
+                auto [id, count] = stats.objectsByID[i];
+                details += fmt::format("{}{} (x{})", i ? ", " : "", id, count);
+            }
+            details += "\n";
+        }
+    }
+    FLAlertLayer::create(
+        "Level Info",
+        fmt::format(
+            "<cb>Objects</c>: {}\n"
+            "{}"
+            "<co>Length</c>: {}\n"
+            "<cp>Time in Editor</c>: {}\n",
+            info.stats ? info.stats->objectCount : info.objectCount,
+            details,
+            GJGameLevel::lengthKeyToString(info.length),
+            info.editorTime
+        ),
+        "OK"
+    )->show();
 }
 
 void TrashcanPopup::onInfo(CCObject* sender) {
     auto obj = static_cast<Trashed*>(static_cast<CCNode*>(sender)->getUserObject());
-    if (auto level = obj->asLevel()) {
-        FLAlertLayer::create(
-            "Level Info",
-            fmt::format(
-                "<cb>Objects</c>: {}\n"
-                "<co>Length</c>: {}\n"
-                "<cp>Time in Editor</c>: {}\n",
-                level->m_objectCount.value(),
-                level->lengthKeyToString(level->m_levelLength),
-                level->m_workingTime
-            ),
-            "OK"
-        )->show();
+    auto& info = obj->getInfo();
+    if (obj->isLevel()) {
+        if (info.stats) {
+            return showLevelInfo(info);
+        }
+        // Only just trashed, so its file may not exist yet
+        if (obj->isPending()) {
+            TrashQueue::get()->flush();
+        }
+        // The exact counts mean decoding the whole level string, so that's 
+        // done on the worker pool and cached in the index afterwards
+        WorkerPool::get()->submit([self = Ref(this), item = Ref(obj)]() mutable {
+            auto stats = item->countStats();
+            Loader::get()->queueInMainThread([self = std::move(self), item = std::move(item), stats = std::move(stats)] {
+                if (stats) {
+                    item->setStats(stats.unwrap());
+                }
+                else {
+                    log::warn("Unable to count stats for '{}': {}", item->getName(), stats.unwrapErr());
+                }
+                if (!self->m_closed) {
+                    showLevelInfo(item->getInfo());
+                }
+            });
+        });
     }
-    else if (auto list = obj->asList()) {
+    else {
         FLAlertLayer::create(
             "List Info",
             fmt::format(
                 "<cb>Levels</c>: {}\n",
-                list->m_levels.size()
+                info.levelCount
             ),
             "OK"
         )->show();
@@ -196,6 +614,80 @@ void TrashcanPopup::onRestore(CCObject* sender) {
         )->show();
     }
 }
+void TrashcanPopup::onSelect(CCObject* sender) {
+    auto obj = static_cast<Trashed*>(static_cast<CCNode*>(sender)->getUserObject());
+    auto& filename = obj->getInfo().filename;
+    // The toggler flips its own state after this
+    if (!m_selected.erase(filename)) {
+        m_selected.insert(filename);
+    }
+    this->updateSelection();
+}
+void TrashcanPopup::onSelectAll(CCObject*) {
+    // Only (de)select what the search and filter let through
+    if (this->isAllShownSelected()) {
+        for (auto item : m_shown) {
+            m_selected.erase(item->getInfo().filename);
+        }
+    }
+    else {
+        for (auto item : m_shown) {
+            m_selected.insert(item->getInfo().filename);
+        }
+    }
+    this->updateSelection();
+    this->updateVisibleRows(true);
+}
+void TrashcanPopup::onRestoreSelected(CCObject*) {
+    auto items = this->getSelectedItems();
+    m_selected.clear();
+    this->updateSelection();
+    auto res = Trashed::untrash(items);
+    if (!res) {
+        FLAlertLayer::create(
+            "Failed to Restore",
+            fmt::format("Failed to restore some items: {}", res.unwrapErr()),
+            "OK"
+        )->show();
+    }
+}
+void TrashcanPopup::onDeleteSelected(CCObject*) {
+    auto items = this->getSelectedItems();
+    createQuickPopup(
+        "Permanently Delete",
+        fmt::format(
+            "Are you sure you want to <cr>permanently delete</c> the <cy>{}</c> selected item{}?\n"
+            "<cr>This can NOT be undone!</c>",
+            items.size(), items.size() == 1 ? "" : "s"
+        ),
+        "Cancel", "Delete",
+        [self = Ref(this), items](auto*, bool btn2) {
+            if (btn2) {
+                self->m_selected.clear();
+                self->updateSelection();
+                auto res = Trashed::KABOOM(items);
+                if (!res) {
+                    FLAlertLayer::create(
+                        "Failed to Delete",
+                        fmt::format("Failed to permanently delete some items: {}", res.unwrapErr()),
+                        "OK"
+                    )->show();
+                }
+            }
+        }
+    );
+}
+void TrashcanPopup::onSort(CCObject*) {
+    m_sort = static_cast<TrashcanSort>((static_cast<int>(m_sort) + 1) % (static_cast<int>(TrashcanSort::MostObjects) + 1));
+    m_sortSpr->setString(getSortName(m_sort));
+    this->updateList();
+}
+void TrashcanPopup::onFilter(CCObject*) {
+    m_filter = static_cast<TrashcanFilter>((static_cast<int>(m_filter) + 1) % (static_cast<int>(TrashcanFilter::Lists) + 1));
+    m_filterSpr->setString(getFilterName(m_filter));
+    this->updateList();
+    this->updateSelection();
+}
 void TrashcanPopup::onDeleteAll(CCObject*) {
     createQuickPopup(
         "Clear Trashcan",
@@ -204,12 +696,20 @@ void TrashcanPopup::onDeleteAll(CCObject*) {
         "Cancel", "Delete All",
         [](auto*, bool btn2) {
             if (btn2) {
-                std::error_code ec;
-                std::filesystem::remove_all(getTrashDir(), ec);
-                if (ec) {
+                // Writes still in flight would either fail or land in the 
+                // wiped directory, so let them finish (and their callbacks 
+                // run) first
+                TrashQueue::get()->flush();
+                auto res = TrashStorage::get()->clear();
+                TrashIndex::get()->clear();
+                invalidateIDs(getTrashDir());
+                UpdateTrashEvent delta;
+                delta.cleared = true;
+                UpdateTrashEvent::queue(delta);
+                if (!res) {
                     FLAlertLayer::create(
                         "Failed to Clear",
-                        fmt::format("Failed to clear trash: {} (code {})", ec.message(), ec.value()),
+                        fmt::format("Failed to clear trash: {}", res.unwrapErr()),
                         "OK"
                     )->show();
                 }
@@ -220,7 +720,7 @@ void TrashcanPopup::onDeleteAll(CCObject*) {
 
 TrashcanPopup* TrashcanPopup::create() {
     auto ret = new TrashcanPopup();
-    if (ret && ret->initAnchored(350, 270)) {
+    if (ret && ret->initAnchored(350, 300)) {
         ret->autorelease();
         return ret;
     }
@@ -1,22 +1,92 @@
 #pragma once
 
 #include "Mod.hpp"
+#include "core/SearchIndex.hpp"
 #include <Geode/ui/Popup.hpp>
+#include <Geode/ui/TextInput.hpp>
+#include <unordered_set>
 
 using namespace geode::prelude;
 
+class TrashcanRow;
+
+enum class TrashcanSort {
+    Newest,
+    Oldest,
+    Name,
+    Largest,
+    MostObjects,
+};
+enum class TrashcanFilter {
+    All,
+    Levels,
+    Lists,
+};
+
 class TrashcanPopup : public Popup<> {
 protected:
     ScrollLayer* m_scrollingLayer;
     EventListener<EventFilter<UpdateTrashEvent>> m_listener;
+    std::vector<Ref<Trashed>> m_items;
+    // The items that match the search and filter, in the order shown
+    std::vector<Trashed*> m_shown;
+    // Names of all of the items; m_searchDocs maps the index's documents 
+    // back to the items (null once removed)
+    SearchIndex m_search;
+    std::vector<Trashed*> m_searchDocs;
+    std::unordered_map<std::string, SearchIndex::DocID> m_searchIDs;
+    std::string m_query;
+    TrashcanSort m_sort = TrashcanSort::Newest;
+    TrashcanFilter m_filter = TrashcanFilter::All;
+    TextInput* m_searchInput;
+    ButtonSprite* m_sortSpr;
+    ButtonSprite* m_filterSpr;
+    CCLabelBMFont* m_noMatchesLabel;
+    // How much smaller deduplicating has made the trash
+    CCLabelBMFont* m_dedupLabel;
+    // Only the rows in view (plus a bit of overscan) exist at any time; rows 
+    // scrolled out of view are hidden and reused for the ones scrolled in
+    std::unordered_map<size_t, TrashcanRow*> m_visibleRows;
+    std::vector<TrashcanRow*> m_freeRows;
+    size_t m_firstVisibleRow = 0;
+    size_t m_lastVisibleRow = 0;
+    // Filenames of the selected items
+    std::unordered_set<std::string> m_selected;
+    ButtonSprite* m_selectAllSpr;
+    CCMenuItemSpriteExtra* m_restoreSelectedBtn;
+    ButtonSprite* m_restoreSelectedSpr;
+    CCMenuItemSpriteExtra* m_deleteSelectedBtn;
+    ButtonSprite* m_deleteSelectedSpr;
+    // Shown until the trash has finished loading
+    CCSprite* m_loadingCircle = nullptr;
+    bool m_closed = false;
 
     bool setup() override;
+    void update(float dt) override;
+    void insertItems(std::vector<Ref<Trashed>> const& items);
+    void removeItems(std::unordered_set<std::string> const& filenames);
+    void onLoaded(std::vector<Ref<Trashed>> const& items, bool done);
+    void applyUpdate(UpdateTrashEvent* event);
+    void updateShown();
     void updateList();
+    void updateVisibleRows(bool force);
+    void updateSelection();
+    bool isAllShownSelected() const;
+    std::vector<Ref<Trashed>> getSelectedItems() const;
 
+    void onClose(CCObject* sender) override;
     void onInfo(CCObject* sender);
     void onDelete(CCObject* sender);
     void onRestore(CCObject* sender);
     void onDeleteAll(CCObject* sender);
+    void onSelect(CCObject* sender);
+    void onSelectAll(CCObject* sender);
+    void onRestoreSelected(CCObject* sender);
+    void onDeleteSelected(CCObject* sender);
+    void onSort(CCObject* sender);
+    void onFilter(CCObject* sender);
+
+    friend class TrashcanRow;
 
 public:
     static TrashcanPopup* create();
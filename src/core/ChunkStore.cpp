@@ -0,0 +1,362 @@
+#include "ChunkStore.hpp"
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <unordered_set>
+#include <zlib.h>
+
+// Random values for the gear hash, from splitmix64 so they're the same on
+// every build (the cut points, and so the chunks, have to stay the same)
+static constexpr std::array<uint64_t, 256> GEAR = [] {
+    std::array<uint64_t, 256> gear {};
+    uint64_t state = 0x5bd1e9955bd1e995;
+    for (auto& value : gear) {
+        state += 0x9e3779b97f4a7c15;
+        auto z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        value = z ^ (z >> 31);
+    }
+    return gear;
+}();
+
+// A mask of the top `bits` bits. The gear hash is shifted left every byte,
+// so its top bits depend on the most bytes
+static uint64_t topBits(unsigned bits) {
+    return bits ? ~uint64_t(0) << (64 - bits) : 0;
+}
+
+std::vector<std::string_view> splitChunks(std::string_view data, ChunkParams const& params) {
+    std::vector<std::string_view> chunks;
+    auto bits = static_cast<unsigned>(std::bit_width(std::max<size_t>(params.avgSize, 2)) - 1);
+    // Normalized chunking: two bits harder before the average, two easier after
+    auto maskSmall = topBits(bits + 2);
+    auto maskLarge = topBits(bits > 2 ? bits - 2 : 1);
+
+    size_t start = 0;
+    while (start < data.size()) {
+        auto remaining = data.size() - start;
+        if (remaining <= params.minSize) {
+            chunks.push_back(data.substr(start));
+            break;
+        }
+        auto end = std::min(remaining, params.maxSize);
+        auto normal = std::min(end, params.avgSize);
+        auto bytes = reinterpret_cast<const uint8_t*>(data.data() + start);
+
+        uint64_t hash = 0;
+        size_t cut = end;
+        for (size_t i = params.minSize; i < end; i += 1) {
+            hash = (hash << 1) + GEAR[bytes[i]];
+            if (!(hash & (i < normal ? maskSmall : maskLarge))) {
+                cut = i + 1;
+                break;
+            }
+        }
+        chunks.push_back(data.substr(start, cut));
+        start += cut;
+    }
+    return chunks;
+}
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+static uint64_t fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccd;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53;
+    k ^= k >> 33;
+    return k;
+}
+static uint64_t loadLE(const uint8_t* data, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i += 1) {
+        value |= static_cast<uint64_t>(data[i]) << (i * 8);
+    }
+    return value;
+}
+
+std::string hashChunk(std::string_view data) {
+    constexpr uint64_t c1 = 0x87c37b91114253d5;
+    constexpr uint64_t c2 = 0x4cf5ad432745937f;
+    auto bytes = reinterpret_cast<const uint8_t*>(data.data());
+    auto size = data.size();
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+
+    size_t blocks = size / 16;
+    for (size_t i = 0; i < blocks; i += 1) {
+        auto k1 = loadLE(bytes + i * 16, 8);
+        auto k2 = loadLE(bytes + i * 16 + 8, 8);
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    auto tail = bytes + blocks * 16;
+    auto tailSize = size & 15;
+    if (tailSize > 8) {
+        auto k2 = loadLE(tail + 8, tailSize - 8);
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    if (tailSize > 0) {
+        auto k1 = loadLE(tail, std::min<size_t>(tailSize, 8));
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= size; h2 ^= size;
+    h1 += h2; h2 += h1;
+    h1 = fmix(h1); h2 = fmix(h2);
+    h1 += h2; h2 += h1;
+
+    static constexpr char HEX[] = "0123456789abcdef";
+    std::string res(32, '0');
+    for (size_t i = 0; i < 16; i += 1) {
+        auto byte = static_cast<uint8_t>((i < 8 ? h1 : h2) >> ((i % 8) * 8));
+        res[i * 2] = HEX[byte >> 4];
+        res[i * 2 + 1] = HEX[byte & 15];
+    }
+    return res;
+}
+
+static void writeU32(std::string& out, uint32_t value) {
+    for (size_t i = 0; i < 4; i += 1) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+bool ChunkRecipe::isRecipe(std::string_view data) {
+    return data.starts_with(MAGIC);
+}
+
+std::optional<ChunkRecipe> ChunkRecipe::decode(std::string_view data) {
+    if (!isRecipe(data)) {
+        return std::nullopt;
+    }
+    size_t offset = MAGIC.size();
+    auto const readU32 = [&]() -> std::optional<uint32_t> {
+        if (offset + 4 > data.size()) {
+            return std::nullopt;
+        }
+        auto value = static_cast<uint32_t>(loadLE(reinterpret_cast<const uint8_t*>(data.data() + offset), 4));
+        offset += 4;
+        return value;
+    };
+    auto const readString = [&](size_t size) -> std::optional<std::string> {
+        if (offset + size > data.size()) {
+            return std::nullopt;
+        }
+        std::string value(data.substr(offset, size));
+        offset += size;
+        return value;
+    };
+
+    ChunkRecipe recipe;
+    if (offset + 1 > data.size()) {
+        return std::nullopt;
+    }
+    recipe.inflatedLevelString = data[offset++] & 0b1;
+    auto headSize = readU32();
+    auto head = readString(headSize.value_or(data.size()));
+    auto tailSize = readU32();
+    auto tail = readString(tailSize.value_or(data.size()));
+    auto count = readU32();
+    if (!head || !tail || !count || offset + *count * size_t(32) != data.size()) {
+        return std::nullopt;
+    }
+    recipe.head = std::move(*head);
+    recipe.tail = std::move(*tail);
+    recipe.chunks.reserve(*count);
+    for (size_t i = 0; i < *count; i += 1) {
+        recipe.chunks.push_back(*readString(32));
+    }
+    return recipe;
+}
+
+std::string ChunkRecipe::encode() const {
+    std::string out;
+    out.reserve(MAGIC.size() + 13 + head.size() + tail.size() + chunks.size() * 32);
+    out += MAGIC;
+    out.push_back(static_cast<char>(inflatedLevelString ? 0b1 : 0));
+    writeU32(out, static_cast<uint32_t>(head.size()));
+    out += head;
+    writeU32(out, static_cast<uint32_t>(tail.size()));
+    out += tail;
+    writeU32(out, static_cast<uint32_t>(chunks.size()));
+    for (auto& hash : chunks) {
+        out += hash;
+    }
+    return out;
+}
+
+double ChunkStore::Stats::getRatio() const {
+    return storedSize ? static_cast<double>(logicalSize) / storedSize : 1;
+}
+
+// The raw size of every chunk is kept in its metadata
+static uint64_t rawSizeOf(PackStore::Entry const& entry) {
+    uint64_t size = 0;
+    std::from_chars(entry.metadata.data(), entry.metadata.data() + entry.metadata.size(), size);
+    return size;
+}
+
+ChunkStore::ChunkStore(std::filesystem::path const& base) : m_pack(base) {}
+
+bool ChunkStore::exists() const {
+    return m_pack.exists();
+}
+bool ChunkStore::open() {
+    return m_pack.open();
+}
+void ChunkStore::close() {
+    std::lock_guard lock(m_mutex);
+    m_pack.close();
+    m_refs.clear();
+    m_counted = false;
+}
+
+bool ChunkStore::isCounted() const {
+    std::lock_guard lock(m_mutex);
+    return m_counted;
+}
+void ChunkStore::count(std::vector<std::vector<std::string>> const& recipes) {
+    std::lock_guard lock(m_mutex);
+    m_refs.clear();
+    // Stored chunks nothing refers to start out at 0, so they get swept
+    for (auto& entry : m_pack.getEntries()) {
+        m_refs.insert({ entry.id, ChunkRef { 0, rawSizeOf(entry) } });
+    }
+    for (auto& recipe : recipes) {
+        for (auto& hash : recipe) {
+            if (auto ref = m_refs.find(hash); ref != m_refs.end()) {
+                ref->second.count += 1;
+            }
+        }
+    }
+    m_counted = true;
+}
+
+std::optional<std::vector<std::string>> ChunkStore::put(std::string_view data, ChunkParams const& params) {
+    auto chunks = splitChunks(data, params);
+    std::vector<std::string> hashes;
+    hashes.reserve(chunks.size());
+    for (auto& chunk : chunks) {
+        hashes.push_back(hashChunk(chunk));
+    }
+
+    std::lock_guard lock(m_mutex);
+    // Deflate the chunks that aren't stored yet
+    std::vector<std::string> deflated;
+    deflated.reserve(chunks.size());
+    std::vector<PackStore::Blob> blobs;
+    std::unordered_set<std::string_view> adding;
+    for (size_t i = 0; i < chunks.size(); i += 1) {
+        if (m_refs.contains(hashes[i]) || m_pack.contains(hashes[i]) || !adding.insert(hashes[i]).second) {
+            continue;
+        }
+        auto& out = deflated.emplace_back();
+        auto bound = compressBound(static_cast<uLong>(chunks[i].size()));
+        out.resize(bound);
+        auto size = static_cast<uLongf>(bound);
+        if (compress2(
+            reinterpret_cast<Bytef*>(out.data()), &size,
+            reinterpret_cast<const Bytef*>(chunks[i].data()), static_cast<uLong>(chunks[i].size()),
+            Z_DEFAULT_COMPRESSION
+        ) != Z_OK) {
+            return std::nullopt;
+        }
+        out.resize(size);
+        blobs.push_back(PackStore::Blob { hashes[i], out, std::to_string(chunks[i].size()) });
+    }
+    if (!m_pack.add(blobs)) {
+        return std::nullopt;
+    }
+    for (size_t i = 0; i < chunks.size(); i += 1) {
+        auto& ref = m_refs[hashes[i]];
+        ref.count += 1;
+        ref.size = chunks[i].size();
+    }
+    return hashes;
+}
+
+std::optional<std::string> ChunkStore::get(std::vector<std::string> const& hashes) const {
+    std::string out;
+    for (auto& hash : hashes) {
+        auto entry = m_pack.getEntry(hash);
+        auto stored = m_pack.read(hash);
+        if (!entry || !stored) {
+            return std::nullopt;
+        }
+        auto size = rawSizeOf(*entry);
+        auto offset = out.size();
+        out.resize(offset + size);
+        auto outSize = static_cast<uLongf>(size);
+        if (uncompress(
+            reinterpret_cast<Bytef*>(out.data() + offset), &outSize,
+            reinterpret_cast<const Bytef*>(stored->data()), static_cast<uLong>(stored->size())
+        ) != Z_OK || outSize != size) {
+            return std::nullopt;
+        }
+    }
+    return out;
+}
+
+void ChunkStore::release(std::vector<std::string> const& hashes) {
+    std::lock_guard lock(m_mutex);
+    if (!m_counted) {
+        return;
+    }
+    for (auto& hash : hashes) {
+        if (auto ref = m_refs.find(hash); ref != m_refs.end() && ref->second.count) {
+            ref->second.count -= 1;
+        }
+    }
+}
+
+bool ChunkStore::sweep() {
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_counted) {
+            return true;
+        }
+        std::vector<std::string> dead;
+        for (auto& [hash, ref] : m_refs) {
+            if (!ref.count) {
+                dead.push_back(hash);
+            }
+        }
+        if (dead.empty()) {
+            return true;
+        }
+        if (!m_pack.remove(dead)) {
+            return false;
+        }
+        for (auto& hash : dead) {
+            m_refs.erase(hash);
+        }
+    }
+    // Compacting doesn't block adding chunks, so it can happen unlocked
+    return !m_pack.shouldCompact() || m_pack.compact();
+}
+
+ChunkStore::Stats ChunkStore::getStats() const {
+    std::lock_guard lock(m_mutex);
+    Stats stats;
+    for (auto& entry : m_pack.getEntries()) {
+        auto ref = m_refs.find(entry.id);
+        auto count = ref != m_refs.end() ? ref->second.count : 0;
+        if (!count) {
+            continue;
+        }
+        auto size = rawSizeOf(entry);
+        stats.logicalSize += size * count;
+        stats.uniqueSize += size;
+        stats.storedSize += entry.length;
+        stats.chunkCount += 1;
+    }
+    return stats;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "PackStore.hpp"
+
+struct ChunkParams final {
+    size_t minSize = 2 * 1024;
+    size_t avgSize = 8 * 1024;
+    size_t maxSize = 64 * 1024;
+};
+
+/**
+ * Split data into content-defined chunks with FastCDC: a rolling gear hash
+ * picks the cut points, so an insertion or deletion only changes the chunks
+ * around it and the rest of the data splits exactly like before. Cut points
+ * are harder to hit before the average size and easier after it, which keeps
+ * chunk sizes close to the average
+ */
+std::vector<std::string_view> splitChunks(std::string_view data, ChunkParams const& params = ChunkParams());
+// 128-bit hash of a chunk's contents (MurmurHash3), as 32 hex digits
+std::string hashChunk(std::string_view data);
+
+/**
+ * How to put a chunked item back together: the chunks' contents joined in
+ * order, between a head and a tail that are stored as is
+ */
+struct ChunkRecipe final {
+    // Recipes start with this, which no plist or compressed trash file does
+    static constexpr std::string_view MAGIC = "BSCR";
+
+    std::string head;
+    std::string tail;
+    std::vector<std::string> chunks;
+    // The chunks make up an inflated level string that has to be encoded
+    // again to get the original item back
+    bool inflatedLevelString = false;
+
+    static bool isRecipe(std::string_view data);
+    static std::optional<ChunkRecipe> decode(std::string_view data);
+    std::string encode() const;
+};
+
+/**
+ * Deduplicating store of chunks by hash, kept in a PackStore with every
+ * chunk deflated on its own. Chunks are reference counted in memory; the
+ * counts aren't stored anywhere, since the recipes referring to the chunks
+ * already say everything there is to know, so they have to be counted once
+ * (from every recipe) before chunks can be released or swept. Chunks are
+ * always added before the recipes that use them and released after those are
+ * gone, so a crash can only ever leave unreferenced chunks behind, which the
+ * next sweep cleans up.
+ *
+ * All methods are thread safe
+ */
+class ChunkStore final {
+public:
+    struct Stats final {
+        // Total size of the data in every recipe, counting shared chunks
+        // once for every recipe that uses them
+        uint64_t logicalSize = 0;
+        // Size of the unique chunks, before and after deflating
+        uint64_t uniqueSize = 0;
+        uint64_t storedSize = 0;
+        size_t chunkCount = 0;
+
+        // How many times smaller the store is than the data in it
+        double getRatio() const;
+    };
+
+protected:
+    struct ChunkRef final {
+        uint32_t count = 0;
+        uint64_t size = 0;
+    };
+
+    PackStore m_pack;
+    mutable std::mutex m_mutex;
+    bool m_counted = false;
+    std::unordered_map<std::string, ChunkRef> m_refs;
+
+public:
+    // `base` is the path of the PackStore's files without their extension
+    ChunkStore(std::filesystem::path const& base);
+
+    ChunkStore(ChunkStore const&) = delete;
+    ChunkStore& operator=(ChunkStore const&) = delete;
+
+    bool exists() const;
+    bool open();
+    void close();
+
+    bool isCounted() const;
+    // Set the reference counts from the chunk lists of every recipe
+    void count(std::vector<std::vector<std::string>> const& recipes);
+
+    // Split data into chunks and take a reference to each one, storing the
+    // ones that aren't stored yet. Returns the chunks' hashes in order
+    std::optional<std::vector<std::string>> put(std::string_view data, ChunkParams const& params = ChunkParams());
+    // Join the contents of chunks back together
+    std::optional<std::string> get(std::vector<std::string> const& hashes) const;
+    // Drop a reference to each chunk (once for every time it's listed)
+    void release(std::vector<std::string> const& hashes);
+    // Delete chunks nothing refers to anymore, and compact the store if
+    // enough of it is garbage. Does nothing until the references are counted
+    bool sweep();
+
+    Stats getStats() const;
+};
@@ -0,0 +1,27 @@
+#include "Dedup.hpp"
+
+std::vector<size_t> orderByRank(std::vector<std::string> const& ids, std::vector<std::string> const& order) {
+    std::unordered_map<std::string_view, size_t> ranks;
+    ranks.reserve(order.size());
+    for (size_t i = 0; i < order.size(); i += 1) {
+        // Rank 0 is for unordered items
+        ranks.try_emplace(order[i], i + 1);
+    }
+    std::vector<size_t> itemRanks;
+    itemRanks.reserve(ids.size());
+    std::vector<size_t> offsets(order.size() + 2, 0);
+    for (auto& id : ids) {
+        auto it = ranks.find(id);
+        auto rank = it != ranks.end() ? it->second : 0;
+        itemRanks.push_back(rank);
+        offsets[rank + 1] += 1;
+    }
+    for (size_t i = 1; i < offsets.size(); i += 1) {
+        offsets[i] += offsets[i - 1];
+    }
+    std::vector<size_t> result(ids.size());
+    for (size_t i = 0; i < ids.size(); i += 1) {
+        result[offsets[itemRanks[i]]++] = i;
+    }
+    return result;
+}
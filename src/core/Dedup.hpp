@@ -0,0 +1,58 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Hash index over the contents of items (level strings, list contents), so 
+ * checking whether an item is a duplicate doesn't need to compare it against 
+ * every existing one. Each item is hashed once; items whose hashes match are 
+ * still compared in full
+ */
+template <class T>
+class ContentIndex final {
+public:
+    using ContentOf = std::function<std::string_view(T const&)>;
+
+protected:
+    ContentOf m_contentOf;
+    std::unordered_multimap<size_t, T> m_items;
+
+    // The whole content is hashed: level strings of the same size that only 
+    // differ somewhere in the middle are common (two saves of the same 
+    // level), and a sampled hash would put all of them in one bucket
+    static size_t hashOf(std::string_view content) {
+        return std::hash<std::string_view>()(content);
+    }
+
+public:
+    ContentIndex(ContentOf contentOf) : m_contentOf(std::move(contentOf)) {}
+
+    void reserve(size_t count) {
+        m_items.reserve(count);
+    }
+    void add(T const& item) {
+        m_items.insert({ hashOf(m_contentOf(item)), item });
+    }
+    T const* findDuplicate(T const& item) const {
+        auto content = m_contentOf(item);
+        auto [begin, end] = m_items.equal_range(hashOf(content));
+        for (auto it = begin; it != end; ++it) {
+            if (m_contentOf(it->second) == content) {
+                return &it->second;
+            }
+        }
+        return nullptr;
+    }
+};
+
+/**
+ * Order items by where their ID appears in `order`. Returns the indices of 
+ * the items in their new order; items not found in `order` come first, in 
+ * the order they were in. Stable, and linear in the number of items (a 
+ * counting sort over the ranks)
+ */
+std::vector<size_t> orderByRank(std::vector<std::string> const& ids, std::vector<std::string> const& order);
@@ -0,0 +1,182 @@
+#include "DirWatcher.hpp"
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#elif defined(__linux__)
+    #include <sys/inotify.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+
+// How long to wait for a burst of changes to settle before reporting them
+static constexpr auto SETTLE_TIME = std::chrono::milliseconds(100);
+
+DirWatcher::DirWatcher(std::filesystem::path const& dir, Callback callback, std::chrono::milliseconds pollInterval)
+  : m_dir(dir), m_callback(std::move(callback)), m_pollInterval(pollInterval) {}
+
+DirWatcher* DirWatcher::start(std::filesystem::path const& dir, Callback callback, std::chrono::milliseconds pollInterval) {
+    auto watcher = new DirWatcher(dir, std::move(callback), pollInterval);
+    std::thread(&DirWatcher::run, watcher).detach();
+    return watcher;
+}
+
+void DirWatcher::run() {
+    while (true) {
+        // Returns if there's no native watcher or the directory goes away, 
+        // in which case polling picks up when it's back
+        this->watchNative();
+        this->pollUntilChanged();
+    }
+}
+
+#ifdef _WIN32
+
+// Whether any of the changes in a buffer filled by ReadDirectoryChangesW are
+// about visible files
+static bool hasVisibleChanges(char const* buffer) {
+    while (true) {
+        auto info = reinterpret_cast<FILE_NOTIFY_INFORMATION const*>(buffer);
+        if (info->FileNameLength == 0 || info->FileName[0] != L'.') {
+            return true;
+        }
+        if (!info->NextEntryOffset) {
+            return false;
+        }
+        buffer += info->NextEntryOffset;
+    }
+}
+
+void DirWatcher::watchNative() {
+    auto handle = CreateFileW(
+        m_dir.wstring().c_str(), FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr
+    );
+    if (handle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    OVERLAPPED overlapped {};
+    overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    alignas(DWORD) char buffer[4096];
+    auto const read = [&] {
+        ResetEvent(overlapped.hEvent);
+        return ReadDirectoryChangesW(
+            handle, buffer, sizeof(buffer), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME,
+            nullptr, &overlapped, nullptr
+        );
+    };
+    // Whether visible files have changed since the last report, which waits 
+    // until no more changes come in for a while
+    bool changed = false;
+    while (overlapped.hEvent && read()) {
+        auto wait = WaitForSingleObject(overlapped.hEvent, changed ? static_cast<DWORD>(SETTLE_TIME.count()) : INFINITE);
+        while (wait == WAIT_TIMEOUT) {
+            changed = false;
+            m_callback();
+            wait = WaitForSingleObject(overlapped.hEvent, INFINITE);
+        }
+        DWORD size = 0;
+        if (wait != WAIT_OBJECT_0 || !GetOverlappedResult(handle, &overlapped, &size, FALSE)) {
+            // The directory was probably deleted
+            break;
+        }
+        // Nothing is returned if the changes didn't fit in the buffer
+        changed = changed || size == 0 || hasVisibleChanges(buffer);
+    }
+    CancelIo(handle);
+    if (overlapped.hEvent) {
+        CloseHandle(overlapped.hEvent);
+    }
+    CloseHandle(handle);
+}
+
+#elif defined(__linux__)
+
+// Read all queued events, returning whether any were about visible files
+static bool drainEvents(int fd) {
+    alignas(inotify_event) char buffer[4096];
+    bool relevant = false;
+    while (true) {
+        auto size = read(fd, buffer, sizeof(buffer));
+        if (size <= 0) {
+            return relevant;
+        }
+        for (char* ptr = buffer; ptr < buffer + size;) {
+            auto event = reinterpret_cast<inotify_event*>(ptr);
+            // Events without a name are about the directory itself
+            if (!event->len || event->name[0] != '.') {
+                relevant = true;
+            }
+            ptr += sizeof(inotify_event) + event->len;
+        }
+    }
+}
+
+void DirWatcher::watchNative() {
+    auto fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    auto mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF;
+    if (inotify_add_watch(fd, m_dir.c_str(), mask) < 0) {
+        close(fd);
+        return;
+    }
+    pollfd pfd { fd, POLLIN, 0 };
+    while (::poll(&pfd, 1, -1) >= 0) {
+        std::this_thread::sleep_for(SETTLE_TIME);
+        if (drainEvents(fd)) {
+            m_callback();
+        }
+        // The watch is gone along with the directory
+        if (!std::filesystem::exists(m_dir)) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+#else
+
+void DirWatcher::watchNative() {}
+
+#endif
+
+// The visible files in a directory, sorted
+static std::vector<std::string> listVisible(std::filesystem::path const& dir) {
+    std::vector<std::string> files;
+    std::error_code ec;
+    for (auto it = std::filesystem::directory_iterator(dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        auto name = it->path().filename().string();
+        if (!name.starts_with(".")) {
+            files.push_back(std::move(name));
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void DirWatcher::pollUntilChanged() {
+    // The modification time of a directory changes whenever an entry is 
+    // added, removed or renamed in it. That includes hidden files, so the 
+    // directory is only listed to find out what changed when it does
+    std::error_code ec;
+    auto last = std::filesystem::last_write_time(m_dir, ec);
+    auto files = listVisible(m_dir);
+    while (true) {
+        std::this_thread::sleep_for(m_pollInterval);
+        auto time = std::filesystem::last_write_time(m_dir, ec);
+        if (ec || time == last) {
+            continue;
+        }
+        last = time;
+        if (listVisible(m_dir) != files) {
+            m_callback();
+            return;
+        }
+    }
+}
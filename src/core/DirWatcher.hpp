@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+
+/**
+ * Watches a directory for files being added, removed or renamed, whether by 
+ * us or by something else (the user, a sync tool). Uses inotify on Linux and 
+ * Android and change notifications on Windows; elsewhere, or if those can't 
+ * be set up, the directory's modification time is polled instead.
+ * 
+ * Changes to hidden files (starting with a dot) are ignored, so scratch 
+ * files written next to the watched ones don't trigger anything. Bursts of 
+ * changes are reported once. The callback runs on the watcher's own thread, 
+ * and the watcher lives for the rest of the game once started
+ */
+class DirWatcher final {
+public:
+    using Callback = std::function<void()>;
+
+protected:
+    std::filesystem::path m_dir;
+    Callback m_callback;
+    std::chrono::milliseconds m_pollInterval;
+
+    DirWatcher(std::filesystem::path const& dir, Callback callback, std::chrono::milliseconds pollInterval);
+
+    void run();
+    void watchNative();
+    void pollUntilChanged();
+
+public:
+    static DirWatcher* start(
+        std::filesystem::path const& dir, Callback callback,
+        std::chrono::milliseconds pollInterval = std::chrono::seconds(2)
+    );
+};
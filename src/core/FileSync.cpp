@@ -0,0 +1,39 @@
+#include "FileSync.hpp"
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+bool syncFile(std::filesystem::path const& path) {
+#ifdef _WIN32
+    auto handle = CreateFileW(
+        path.wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+    );
+    if (handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    auto ok = FlushFileBuffers(handle);
+    CloseHandle(handle);
+    return ok;
+#else
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    auto ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+#endif
+}
+bool syncDirectory(std::filesystem::path const& path) {
+#ifdef _WIN32
+    // Renames are journaled by NTFS; directories can't be flushed on Windows
+    return true;
+#else
+    return syncFile(path);
+#endif
+}
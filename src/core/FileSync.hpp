@@ -0,0 +1,7 @@
+#pragma once
+
+#include <filesystem>
+
+// Flush a file's or a directory's contents to the storage device
+bool syncFile(std::filesystem::path const& path);
+bool syncDirectory(std::filesystem::path const& path);
@@ -0,0 +1,122 @@
+#include "Filenames.hpp"
+#include <cctype>
+
+static constexpr size_t hash(char const* str, size_t seed = 0) {
+    return *str ? hash(str + 1, (seed ^ static_cast<unsigned char>(*str)) * 0x100000001b3) : seed;
+}
+
+std::string convertToKebabCase(std::string const& str) {
+	std::string res {};
+	char last = '\0';
+	for (auto ch : str) {
+		auto c = static_cast<unsigned char>(ch);
+		// Add a dash if the character is in uppercase (camelCase / PascalCase) 
+		// or a space (Normal case) or an underscore (snake_case) and the 
+		// built result string isn't empty and make sure there's only a 
+		// singular dash
+		// Don't add a dash if the previous character was also uppercase or a 
+		// number (SCREAM1NG L33TCASE should be just scream1ng-l33tcase)
+		if ((std::isupper(c) && !(std::isupper(last) || std::isdigit(last))) || std::isspace(c) || c == '_') {
+			if (res.size() && res.back() != '-') {
+				res.push_back('-');
+			}
+		}
+		// Only preserve alphanumeric characters
+		if (std::isalnum(c)) {
+			res.push_back(std::tolower(c));
+		}
+		last = c;
+	}
+	// If there is a dash at the end (for example because the name ended in a 
+	// space) then get rid of that
+	if (res.size() && res.back() == '-') {
+		res.pop_back();
+	}
+	return res;
+}
+void checkReservedFilenames(std::string& name) {
+    switch (hash(name.c_str())) {
+        case hash("con"): case hash("prn"): case hash("aux"): case hash("nul"):
+        // This was in https://www.boost.org/doc/libs/1_36_0/libs/filesystem/doc/portability_guide.htm?
+        // Never heard of it before though
+        case hash("clock$"):
+        case hash("com1"): case hash("com2"): case hash("com3"): case hash("com4"):
+        case hash("com5"): case hash("com6"): case hash("com7"): case hash("com8"): case hash("com9"):
+        case hash("lpt1"): case hash("lpt2"): case hash("lpt3"): case hash("lpt4"):
+        case hash("lpt5"): case hash("lpt6"): case hash("lpt7"): case hash("lpt8"): case hash("lpt9"):
+        {
+            name += "-0";
+        }
+        break;
+
+        default: {} break;
+    }
+}
+
+NameRegistry::Directory& NameRegistry::getDirectory(std::filesystem::path const& dir) {
+    auto [it, inserted] = m_dirs.try_emplace(dir.string());
+    if (inserted) {
+        std::error_code ec;
+        for (auto& file : std::filesystem::directory_iterator(dir, ec)) {
+            it->second.taken.insert(file.path().filename().string());
+        }
+    }
+    return it->second;
+}
+
+void NameRegistry::reserve(std::filesystem::path const& path) {
+    this->getDirectory(path.parent_path()).taken.insert(path.filename().string());
+}
+void NameRegistry::release(std::filesystem::path const& path) {
+    auto it = m_dirs.find(path.parent_path().string());
+    if (it != m_dirs.end()) {
+        it->second.taken.erase(path.filename().string());
+    }
+}
+void NameRegistry::invalidate(std::filesystem::path const& dir) {
+    m_dirs.erase(dir.string());
+}
+
+std::string NameRegistry::getFreeID(std::string const& orig, std::filesystem::path const& dir, std::string const& ext) {
+    // Synthesize an ID for the level by taking the level name in kebab-case 
+    // and then adding an incrementing number at the end until there exists 
+    // no file with the same name already
+    auto name = convertToKebabCase(orig);
+    
+    // Prevent names that are too long (some people might use input bypass 
+    // to give levels absurdly long names)
+    if (name.size() > 20) {
+        name = name.substr(0, 20);
+    }
+    if (name.empty()) {
+        name = "unnamed";
+    }
+
+    // Check that no one has made a level called CON
+    checkReservedFilenames(name);
+
+    auto& registry = this->getDirectory(dir);
+    auto id = name + "." + ext;
+    auto withSuffix = [&](size_t suffix) {
+        return name + "-" + std::to_string(suffix) + "." + ext;
+    };
+    // Start where the last search for this name left off, so trashing a 
+    // hundred levels with the same name doesn't go through every suffix 
+    // each time
+    auto& counter = registry.nextSuffix[id];
+    if (counter > 0) {
+        id = withSuffix(counter - 1);
+    }
+
+    // The registry may be out of date if something else has written to the 
+    // directory, so still check the candidate actually found
+    std::error_code ec;
+    while (registry.taken.contains(id) || std::filesystem::exists(dir / id, ec)) {
+        registry.taken.insert(id);
+        id = withSuffix(counter);
+        counter += 1;
+    }
+    registry.taken.insert(id);
+
+    return id;
+}
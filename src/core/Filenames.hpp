@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <filesystem>
+#include <unordered_map>
+#include <unordered_set>
+
+// Turn a level or list name into something usable as a filename
+std::string convertToKebabCase(std::string const& str);
+// Add a suffix to names that are reserved on Windows (CON, NUL, COM1, ...)
+void checkReservedFilenames(std::string& name);
+
+/**
+ * Hands out free filenames in directories. Filenames known to be taken are
+ * cached per directory, so finding a free one doesn't need to stat every
+ * candidate; the cache is loaded once per directory and has to be kept up to
+ * date by whoever writes to it. Not thread-safe
+ */
+class NameRegistry final {
+protected:
+    struct Directory final {
+        std::unordered_set<std::string> taken;
+        // Next suffix to try for a given base name + extension
+        std::unordered_map<std::string, size_t> nextSuffix;
+    };
+    std::unordered_map<std::string, Directory> m_dirs;
+
+    Directory& getDirectory(std::filesystem::path const& dir);
+
+public:
+    // Find a free filename for an item with the given name and mark it taken
+    std::string getFreeID(std::string const& name, std::filesystem::path const& dir, std::string const& ext);
+    void reserve(std::filesystem::path const& path);
+    void release(std::filesystem::path const& path);
+    // Forget everything known about a directory
+    void invalidate(std::filesystem::path const& dir);
+};
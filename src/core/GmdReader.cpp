@@ -0,0 +1,305 @@
+#include "GmdReader.hpp"
+#include <fstream>
+#include <cstring>
+#include <charconv>
+#include <cctype>
+
+// Everything after the level string is small (a few dozen short keys), so
+// when the reader hits k4 it can jump to this far from the end of the file
+// and pick up from there
+static constexpr size_t TAIL_SIZE = 32 * 1024;
+// A base64 run at least this long can only be the level string: everything 
+// else in a level (the description included) is a lot shorter
+static constexpr size_t MIN_LEVEL_STRING_RUN = 4 * 1024;
+static constexpr size_t CHUNK_SIZE = 16 * 1024;
+// Tags are never longer than this; anything longer means the file is garbage
+static constexpr size_t MAX_TAG_SIZE = 256;
+
+bool GmdMetadata::isLevel() const {
+    return type == LEVEL_TYPE;
+}
+
+namespace {
+    class PlistScanner final {
+    protected:
+        std::ifstream m_stream;
+        char m_buffer[CHUNK_SIZE];
+        size_t m_pos = 0;
+        size_t m_size = 0;
+        // File offset of m_buffer[0]
+        uintmax_t m_offset = 0;
+
+        bool refill() {
+            m_offset += m_size;
+            m_pos = 0;
+            m_stream.read(m_buffer, CHUNK_SIZE);
+            m_size = static_cast<size_t>(m_stream.gcount());
+            return m_size > 0;
+        }
+        bool ensure() {
+            return m_pos < m_size || this->refill();
+        }
+
+    public:
+        bool open(std::filesystem::path const& path) {
+            m_stream.open(path, std::ios::binary);
+            return m_stream.is_open();
+        }
+        uintmax_t tell() const {
+            return m_offset + m_pos;
+        }
+        void seek(uintmax_t offset) {
+            m_stream.clear();
+            m_stream.seekg(static_cast<std::streamoff>(offset));
+            m_offset = offset;
+            m_pos = 0;
+            m_size = 0;
+        }
+
+        bool startsWith(std::string_view prefix) {
+            return this->ensure() && m_size - m_pos >= prefix.size() &&
+                std::memcmp(m_buffer + m_pos, prefix.data(), prefix.size()) == 0;
+        }
+
+        // Read up to the next '<', appending the text to `out` if provided
+        bool readText(std::string* out) {
+            while (this->ensure()) {
+                auto start = m_buffer + m_pos;
+                auto found = static_cast<char*>(std::memchr(start, '<', m_size - m_pos));
+                auto end = found ? found : m_buffer + m_size;
+                if (out) {
+                    out->append(start, end);
+                }
+                m_pos = end - m_buffer;
+                if (found) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Skip up to the next '<', failing if anything that isn't base64
+        // is encountered on the way
+        bool skipBase64() {
+            while (this->ensure()) {
+                for (; m_pos < m_size; m_pos += 1) {
+                    auto c = m_buffer[m_pos];
+                    if (c == '<') {
+                        return true;
+                    }
+                    if (!(std::isalnum(static_cast<unsigned char>(c)) || c == '+' || c == '/' || c == '=' || c == '-' || c == '_')) {
+                        return false;
+                    }
+                }
+            }
+            return false;
+        }
+        // Read a tag, assuming the current character is '<'
+        bool readTag(std::string& tag) {
+            tag.clear();
+            if (!this->ensure() || m_buffer[m_pos] != '<') {
+                return false;
+            }
+            m_pos += 1;
+            while (this->ensure()) {
+                auto c = m_buffer[m_pos++];
+                if (c == '>') {
+                    return true;
+                }
+                if (tag.size() >= MAX_TAG_SIZE) {
+                    return false;
+                }
+                tag.push_back(c);
+            }
+            return false;
+        }
+    };
+}
+
+static std::string decodeEntities(std::string const& str) {
+    if (str.find('&') == std::string::npos) {
+        return str;
+    }
+    static constexpr std::pair<std::string_view, char> ENTITIES[] = {
+        { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' },
+    };
+    std::string res;
+    res.reserve(str.size());
+    for (size_t i = 0; i < str.size(); i += 1) {
+        if (str[i] == '&') {
+            for (auto& [entity, c] : ENTITIES) {
+                if (std::string_view(str).substr(i).starts_with(entity)) {
+                    res.push_back(c);
+                    i += entity.size() - 1;
+                    goto next_char;
+                }
+            }
+        }
+        res.push_back(str[i]);
+        next_char:;
+    }
+    return res;
+}
+
+static int parseInt(std::string const& str) {
+    int value = 0;
+    std::from_chars(str.data(), str.data() + str.size(), value);
+    return value;
+}
+
+// Read the metadata of a file, plus the level string and description if
+// `full` is given (in which case the whole file has to be read)
+static std::optional<GmdMetadata> scanGmd(std::filesystem::path const& path, GmdLevelData* full) {
+    PlistScanner scanner;
+    if (!scanner.open(path)) {
+        return std::nullopt;
+    }
+    std::error_code ec;
+    auto fileSize = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    // Compressed trash files keep a plain copy of the metadata up front
+    if (scanner.startsWith(COMPRESSED_GMD_MAGIC)) {
+        // ...and nothing else readable
+        if (full) {
+            return std::nullopt;
+        }
+        scanner.seek(COMPRESSED_GMD_MAGIC.size() + sizeof(uint32_t));
+    }
+
+    enum Found : unsigned {
+        FoundType        = 0b000001,
+        FoundName        = 0b000010,
+        FoundRevision    = 0b000100,
+        FoundObjectCount = 0b001000,
+        FoundLength      = 0b010000,
+        FoundWorkingTime = 0b100000,
+        FoundAll         = 0b111111,
+    };
+
+    GmdMetadata meta;
+    unsigned found = 0;
+    bool sawDict = false;
+    int depth = 0;
+    bool haveKey = false;
+    std::string tag, key, value;
+
+    while ((full || found != FoundAll) && scanner.readText(nullptr) && scanner.readTag(tag)) {
+        if (tag == "dict" || tag == "d") {
+            depth += 1;
+            sawDict = true;
+            haveKey = false;
+        }
+        else if (tag == "/dict" || tag == "/d") {
+            depth -= 1;
+            if (depth <= 0) {
+                break;
+            }
+        }
+        // Self-closing values like <t /> or empty dicts
+        else if (tag.ends_with('/')) {
+            haveKey = false;
+        }
+        else if (tag == "k") {
+            key.clear();
+            if (!scanner.readText(&key) || !scanner.readTag(tag)) {
+                break;
+            }
+            // Only keys of the root dictionary are of interest
+            haveKey = depth == 1;
+        }
+        else if (tag == "s" || tag == "i" || tag == "r") {
+            if (haveKey && key == "k4" && full) {
+                full->levelString.clear();
+                if (!scanner.readText(&full->levelString)) {
+                    break;
+                }
+            }
+            else if (haveKey && key == "k4") {
+                // The level string is base64, so if we jump into the middle
+                // of it there should be nothing but base64 until its closing
+                // tag. Landing in some other value (a name or a number) looks
+                // the same though, so the jump only counts if the run of
+                // base64 up to the closing tag is too long to be anything
+                // but the level string. Otherwise go back and skip it the 
+                // slow way
+                auto resume = scanner.tell();
+                bool jumped = false;
+                if (fileSize > resume + TAIL_SIZE + MIN_LEVEL_STRING_RUN) {
+                    auto start = fileSize - TAIL_SIZE - MIN_LEVEL_STRING_RUN;
+                    scanner.seek(start);
+                    jumped = scanner.skipBase64() &&
+                        scanner.tell() >= start + MIN_LEVEL_STRING_RUN &&
+                        scanner.startsWith("</s>");
+                    if (!jumped) {
+                        scanner.seek(resume);
+                    }
+                }
+                if (!jumped && !scanner.readText(nullptr)) {
+                    break;
+                }
+            }
+            else if (haveKey) {
+                value.clear();
+                if (!scanner.readText(&value)) {
+                    break;
+                }
+                if (key == "kCEK") {
+                    meta.type = parseInt(value);
+                    found |= FoundType;
+                }
+                else if (key == "k2") {
+                    meta.name = decodeEntities(value);
+                    found |= FoundName;
+                }
+                else if (key == "k46") {
+                    meta.revision = parseInt(value);
+                    found |= FoundRevision;
+                }
+                else if (key == "k48") {
+                    meta.objectCount = parseInt(value);
+                    found |= FoundObjectCount;
+                }
+                else if (key == "k23") {
+                    meta.length = parseInt(value);
+                    found |= FoundLength;
+                }
+                else if (key == "k80") {
+                    meta.workingTime = parseInt(value);
+                    found |= FoundWorkingTime;
+                }
+                else if (key == "k3" && full) {
+                    full->description = decodeEntities(value);
+                }
+            }
+            else if (!scanner.readText(nullptr)) {
+                break;
+            }
+            haveKey = false;
+            // Closing tag of the value
+            if (!scanner.readTag(tag)) {
+                break;
+            }
+        }
+        // Anything else (xml declaration, <plist>, etc.) is ignored
+    }
+
+    if (!sawDict) {
+        return std::nullopt;
+    }
+    return meta;
+}
+
+std::optional<GmdMetadata> readGmdMetadata(std::filesystem::path const& path) {
+    return scanGmd(path, nullptr);
+}
+
+std::optional<GmdLevelData> readGmdLevel(std::filesystem::path const& path) {
+    GmdLevelData data;
+    auto meta = scanGmd(path, &data);
+    if (!meta) {
+        return std::nullopt;
+    }
+    data.meta = std::move(*meta);
+    return data;
+}
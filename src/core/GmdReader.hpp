@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <optional>
+#include <filesystem>
+#include <string_view>
+
+// The bits of a .gmd file we care about when listing files, read without
+// touching the level data
+struct GmdMetadata final {
+    // kCEK, the encoder key GD uses to tell object types apart
+    int type = 0;
+    std::string name;
+    int revision = 0;
+    int objectCount = 0;
+    int length = 0;
+    int workingTime = 0;
+
+    // kCEK value of GJGameLevel
+    static constexpr int LEVEL_TYPE = 4;
+
+    bool isLevel() const;
+};
+
+// Compressed trash files (see TrashCodec.hpp) start with this, followed by
+// the size of a plain plist block with the file's metadata
+constexpr std::string_view COMPRESSED_GMD_MAGIC = "BSZ1";
+
+/**
+ * Read the metadata of a level .gmd file by streaming through its plist. The
+ * level string (k4) is never stored; if the file is large, the reader jumps
+ * straight to the end of the file where the rest of the keys live instead of
+ * scanning through the level data. For compressed trash files only the
+ * metadata block at the start is read. Returns nullopt if the file could not be
+ * opened or is not a plist
+ */
+std::optional<GmdMetadata> readGmdMetadata(std::filesystem::path const& path);
+
+// A level .gmd file read in full, as far as that's possible without Cocos:
+// enough to update an existing level in place or tell duplicates apart
+struct GmdLevelData final {
+    GmdMetadata meta;
+    // k4 and k3, as stored in the file (base64)
+    std::string levelString;
+    std::string description;
+};
+
+/**
+ * Read the metadata, level string and description of a level .gmd file with
+ * the same streaming reader as readGmdMetadata, but without skipping the
+ * level string. Safe to call from any thread. Returns nullopt if the file
+ * could not be read or is a compressed trash file
+ */
+std::optional<GmdLevelData> readGmdLevel(std::filesystem::path const& path);
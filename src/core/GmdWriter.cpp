@@ -0,0 +1,78 @@
+#include "GmdWriter.hpp"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+void GmdWriter::flush() {
+    if (m_size && !m_failed) {
+        m_stream.write(m_buffer, static_cast<std::streamsize>(m_size));
+        m_failed = !m_stream;
+    }
+    m_size = 0;
+}
+
+bool GmdWriter::open(std::filesystem::path const& path) {
+    // Has to be done before opening to take effect everywhere
+    m_stream.rdbuf()->pubsetbuf(nullptr, 0);
+    m_stream.open(path, std::ios::binary | std::ios::trunc);
+    m_size = 0;
+    m_failed = !m_stream.is_open();
+    return !m_failed;
+}
+
+void GmdWriter::write(std::string_view text) {
+    while (text.size()) {
+        if (m_size == BUFFER_SIZE) {
+            this->flush();
+        }
+        auto count = std::min(text.size(), BUFFER_SIZE - m_size);
+        std::memcpy(m_buffer + m_size, text.data(), count);
+        m_size += count;
+        text.remove_prefix(count);
+    }
+}
+
+void GmdWriter::writeEscaped(std::string_view text) {
+    // Level strings are base64, so there's usually nothing to escape and the
+    // runs between special characters get copied in bulk
+    while (text.size()) {
+        auto special = text.find_first_of("&<>");
+        this->write(text.substr(0, special));
+        if (special == std::string_view::npos) {
+            return;
+        }
+        switch (text[special]) {
+            case '&': this->write("&amp;"); break;
+            case '<': this->write("&lt;"); break;
+            case '>': this->write("&gt;"); break;
+        }
+        text.remove_prefix(special + 1);
+    }
+}
+
+bool GmdWriter::close() {
+    this->flush();
+    m_stream.close();
+    return !m_failed && !m_stream.fail();
+}
+
+bool writeSplicedPlist(
+    std::filesystem::path const& path, std::string_view plist,
+    std::string_view placeholder, std::string_view value
+) {
+    auto marker = "<s>" + std::string(placeholder) + "</s>";
+    auto pos = plist.find(marker);
+    if (pos == std::string_view::npos) {
+        return false;
+    }
+    // Keep the tags around the value and only swap what's between them
+    auto valueStart = pos + 3;
+    GmdWriter writer;
+    if (!writer.open(path)) {
+        return false;
+    }
+    writer.write(plist.substr(0, valueStart));
+    writer.writeEscaped(value);
+    writer.write(plist.substr(valueStart + placeholder.size()));
+    return writer.close();
+}
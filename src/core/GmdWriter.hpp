@@ -0,0 +1,45 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string_view>
+
+/**
+ * File writer with a single fixed-size buffer, for writing plists with huge
+ * values (level strings) without ever building the whole document in memory.
+ * The stream's own buffering is turned off, so the buffer here is the only
+ * extra memory a write uses no matter how much is written
+ */
+class GmdWriter final {
+public:
+    static constexpr size_t BUFFER_SIZE = 32 * 1024;
+
+protected:
+    std::ofstream m_stream;
+    char m_buffer[BUFFER_SIZE];
+    size_t m_size = 0;
+    bool m_failed = false;
+
+    void flush();
+
+public:
+    bool open(std::filesystem::path const& path);
+    // Write the text as is
+    void write(std::string_view text);
+    // Write a plist value, escaping what XML needs escaped like pugixml
+    // (which GD and gmd-api use) does
+    void writeEscaped(std::string_view text);
+    // Flush and close the file. Returns false if any write failed
+    bool close();
+};
+
+/**
+ * Write a plist to a file with one of its string values swapped out for
+ * another: `plist` is written with the (first) `<s>placeholder</s>` in it
+ * replaced by `value`, escaped. Returns false if the placeholder isn't in the
+ * plist or the file could not be written
+ */
+bool writeSplicedPlist(
+    std::filesystem::path const& path, std::string_view plist,
+    std::string_view placeholder, std::string_view value
+);
@@ -0,0 +1,319 @@
+#include "LevelStats.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <unordered_map>
+#include <zlib.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define BETTERSAVE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+    #define BETTERSAVE_NEON
+#endif
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// Object IDs below this are counted in a flat array; there are no official
+// objects past it (yet)
+static constexpr int MAX_COUNTED_ID = 8192;
+// Groups go up to 9999
+static constexpr int MAX_GROUP = 10000;
+
+static constexpr int TRIGGER_IDS[] = {
+    // Color, move, pulse, alpha, toggle, spawn, rotate, follow, shake, etc.
+    22, 23, 24, 25, 26, 27, 28, 29, 30, 32, 33, 55, 56, 57, 58, 59, 104, 105,
+    221, 717, 718, 743, 744, 899, 900, 901, 915, 1006, 1007, 1049, 1268, 1346,
+    1347, 1520, 1585, 1595, 1611, 1612, 1613, 1615, 1616, 1811, 1812, 1814,
+    1815, 1817, 1818, 1819, 1912, 1913, 1914, 1915, 1916, 1917, 1932, 1934,
+    1935, 2015, 2016, 2062, 2066, 2067, 2068, 2899, 2900, 2901, 2903, 2904,
+    2905, 2907, 2909, 2910, 2911, 2912, 2913, 2914, 2915, 2916, 2917, 2919,
+    2920, 2921, 2922, 2923, 2924, 2925, 2999, 3006, 3007, 3008, 3009, 3010,
+    3011, 3012, 3013, 3014, 3015, 3016, 3017, 3018, 3019, 3020, 3021, 3022,
+    3023, 3024, 3029, 3030, 3031, 3032, 3033, 3600, 3602, 3603, 3604, 3605,
+    3606, 3607, 3608, 3609, 3612, 3613, 3614, 3615, 3617, 3618, 3619, 3620,
+    3640, 3641, 3642, 3660, 3661, 3662,
+};
+
+bool isTriggerObject(int id) {
+    static auto const triggers = [] {
+        std::array<bool, MAX_COUNTED_ID> res {};
+        for (auto trigger : TRIGGER_IDS) {
+            res[trigger] = true;
+        }
+        return res;
+    }();
+    return id >= 0 && id < MAX_COUNTED_ID && triggers[id];
+}
+
+std::optional<std::string> decodeLevelString(std::string_view encoded) {
+    static auto const table = [] {
+        std::array<int8_t, 256> res;
+        res.fill(-1);
+        constexpr std::string_view ALPHABET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+        for (size_t i = 0; i < ALPHABET.size(); i += 1) {
+            res[static_cast<uint8_t>(ALPHABET[i])] = static_cast<int8_t>(i);
+        }
+        // Both the URL-safe and the normal alphabet
+        res['-'] = res['+'] = 62;
+        res['_'] = res['/'] = 63;
+        return res;
+    }();
+
+    while (encoded.size() && (encoded.back() == '=' || encoded.back() == '\0')) {
+        encoded.remove_suffix(1);
+    }
+    std::string compressed;
+    compressed.resize(encoded.size() / 4 * 3 + 3);
+    size_t out = 0;
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (auto c : encoded) {
+        auto value = table[static_cast<uint8_t>(c)];
+        if (value < 0) {
+            return std::nullopt;
+        }
+        bits = bits << 6 | static_cast<uint32_t>(value);
+        bitCount += 6;
+        if (bitCount >= 8) {
+            bitCount -= 8;
+            compressed[out++] = static_cast<char>(bits >> bitCount);
+        }
+    }
+    compressed.resize(out);
+
+    z_stream stream {};
+    // Detect gzip or zlib headers
+    if (inflateInit2(&stream, MAX_WBITS + 32) != Z_OK) {
+        return std::nullopt;
+    }
+    std::string decoded;
+    decoded.resize(std::max<size_t>(compressed.size() * 4, 4096));
+    stream.next_in = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_in = static_cast<uInt>(compressed.size());
+    int res = Z_OK;
+    while (res == Z_OK) {
+        if (stream.total_out == decoded.size()) {
+            decoded.resize(decoded.size() * 2);
+        }
+        stream.next_out = reinterpret_cast<Bytef*>(decoded.data() + stream.total_out);
+        stream.avail_out = static_cast<uInt>(decoded.size() - stream.total_out);
+        res = inflate(&stream, Z_NO_FLUSH);
+    }
+    decoded.resize(stream.total_out);
+    inflateEnd(&stream);
+    if (res != Z_STREAM_END) {
+        return std::nullopt;
+    }
+    return decoded;
+}
+
+// Bit i is set if data[i] is c (data must have 64 bytes)
+static uint64_t matchByte(char const* data, char c) {
+#if defined(BETTERSAVE_SSE2)
+    auto const target = _mm_set1_epi8(c);
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; i += 1) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + i * 16));
+        mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, target)))) << (i * 16);
+    }
+    return mask;
+#elif defined(BETTERSAVE_NEON)
+    auto const target = vdupq_n_u8(static_cast<uint8_t>(c));
+    // NEON has no movemask, so keep one bit per byte and add neighbouring 
+    // bytes together until each byte holds 8 bits of the mask
+    static uint8_t const BITS[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    auto const bits = vld1q_u8(BITS);
+    uint8x16_t matches[4];
+    for (int i = 0; i < 4; i += 1) {
+        auto chunk = vld1q_u8(reinterpret_cast<uint8_t const*>(data + i * 16));
+        matches[i] = vandq_u8(vceqq_u8(chunk, target), bits);
+    }
+    auto sum = vpaddq_u8(vpaddq_u8(matches[0], matches[1]), vpaddq_u8(matches[2], matches[3]));
+    sum = vpaddq_u8(sum, sum);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+#else
+    // Find the bytes that are zero after XORing with c, 8 at a time, then 
+    // gather the top bit of each byte into the mask
+    uint64_t mask = 0;
+    for (int i = 0; i < 8; i += 1) {
+        uint64_t word;
+        std::memcpy(&word, data + i * 8, 8);
+        auto x = word ^ (0x0101010101010101ull * static_cast<uint8_t>(c));
+        auto t = (x & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full;
+        auto match = ~(t | x | 0x7f7f7f7f7f7f7f7full);
+        // Assumes a little-endian CPU, which is all GD runs on
+        mask |= (((match >> 7) * 0x0102040810204080ull) >> 56) << (i * 8);
+    }
+    return mask;
+#endif
+}
+
+static int countTrailingZeros(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+static int parseInt(std::string_view str) {
+    int value = 0;
+    for (auto c : str) {
+        if (c < '0' || c > '9') {
+            break;
+        }
+        value = value * 10 + (c - '0');
+    }
+    return value;
+}
+
+// The field starting at `pos`, up to the next ',' or ';'
+static std::string_view fieldAt(std::string_view data, size_t pos) {
+    auto end = pos;
+    while (end < data.size() && data[end] != ',' && data[end] != ';') {
+        end += 1;
+    }
+    return data.substr(pos, end - pos);
+}
+
+namespace {
+    // Counts the objects as they go by
+    struct Counter final {
+        std::string_view data;
+        std::vector<uint32_t> byID = std::vector<uint32_t>(MAX_COUNTED_ID);
+        std::unordered_map<int, size_t> byLargeID;
+        std::vector<bool> groups = std::vector<bool>(MAX_GROUP);
+        LevelStats stats;
+
+        // Where the object with the last groups found starts
+        size_t groupedStart = std::string_view::npos;
+
+        void addObject(int id) {
+            stats.objectCount += 1;
+            if (id < MAX_COUNTED_ID) {
+                byID[id] += 1;
+            }
+            else {
+                byLargeID[id] += 1;
+            }
+        }
+
+        void startObject(size_t pos) {
+            if (pos >= data.size() || data[pos] == ';') {
+                return;
+            }
+            // GD always writes the object ID first
+            if (pos + 2 < data.size() && data[pos] == '1' && data[pos + 1] == ',') {
+                return this->addObject(parseInt(data.substr(pos + 2)));
+            }
+            // Otherwise go through the keys until it shows up, stopping at 
+            // the end of the object
+            bool isKey = true;
+            for (size_t field = pos; field < data.size(); ) {
+                auto text = fieldAt(data, field);
+                if (isKey && text == "1") {
+                    return this->addObject(parseInt(fieldAt(data, field + 2)));
+                }
+                auto end = field + text.size();
+                if (end >= data.size() || data[end] == ';') {
+                    return;
+                }
+                isKey = !isKey;
+                field = end + 1;
+            }
+        }
+
+        // `comma` is followed by "57,", which is the groups key if it's in 
+        // a key's place: after an even number of commas in its object
+        void checkGroups(size_t comma) {
+            size_t commas = 0;
+            auto objectStart = comma + 1;
+            for (; objectStart > 0 && data[objectStart - 1] != ';'; objectStart -= 1) {
+                commas += data[objectStart - 1] == ',';
+            }
+            if (commas % 2) {
+                return;
+            }
+            auto text = fieldAt(data, comma + 4);
+            if (text.empty()) {
+                return;
+            }
+            // Group IDs are separated by '.'
+            size_t start = 0;
+            while (start <= text.size()) {
+                auto end = text.find('.', start);
+                if (end == std::string_view::npos) {
+                    end = text.size();
+                }
+                auto group = parseInt(text.substr(start, end - start));
+                if (group > 0 && group < MAX_GROUP) {
+                    groups[group] = true;
+                }
+                start = end + 1;
+            }
+            if (groupedStart != objectStart) {
+                groupedStart = objectStart;
+                stats.groupedObjects += 1;
+            }
+        }
+    };
+}
+
+LevelStats analyzeLevelString(std::string_view decoded) {
+    Counter counter;
+    counter.data = decoded;
+    counter.stats.decodedSize = decoded.size();
+
+    // The first "object" is the level's settings
+    auto settingsEnd = decoded.find(';');
+    if (settingsEnd == std::string_view::npos) {
+        return counter.stats;
+    }
+    counter.startObject(settingsEnd + 1);
+
+    // Only two things need finding: the ';' between objects, and the 
+    // ",57," of the groups key. Everything else is skipped over in bulk
+    auto data = decoded.data();
+    size_t pos = settingsEnd + 1;
+    for (; pos + 64 + 3 <= decoded.size(); pos += 64) {
+        auto block = data + pos;
+        for (auto ends = matchByte(block, ';'); ends; ends &= ends - 1) {
+            counter.startObject(pos + countTrailingZeros(ends) + 1);
+        }
+        auto groups = matchByte(block, ',') & matchByte(block + 1, '5') &
+            matchByte(block + 2, '7') & matchByte(block + 3, ',');
+        for (; groups; groups &= groups - 1) {
+            counter.checkGroups(pos + countTrailingZeros(groups));
+        }
+    }
+    for (; pos < decoded.size(); pos += 1) {
+        if (data[pos] == ';') {
+            counter.startObject(pos + 1);
+        }
+        else if (decoded.substr(pos).starts_with(",57,")) {
+            counter.checkGroups(pos);
+        }
+    }
+
+    auto& stats = counter.stats;
+    for (int id = 0; id < MAX_COUNTED_ID; id += 1) {
+        if (counter.byID[id]) {
+            stats.objectsByID.push_back({ id, counter.byID[id] });
+            if (isTriggerObject(id)) {
+                stats.triggerCount += counter.byID[id];
+            }
+        }
+    }
+    stats.objectsByID.insert(stats.objectsByID.end(), counter.byLargeID.begin(), counter.byLargeID.end());
+    std::stable_sort(stats.objectsByID.begin(), stats.objectsByID.end(), [](auto const& a, auto const& b) {
+        return a.second > b.second;
+    });
+    stats.groupCount = std::count(counter.groups.begin(), counter.groups.end(), true);
+    return stats;
+}
@@ -0,0 +1,613 @@
+#include "PackStore.hpp"
+#include "FileSync.hpp"
+#include <zlib.h>
+#include <algorithm>
+#include <fstream>
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+static constexpr std::string_view INDEX_MAGIC = "BSPI";
+static constexpr uint32_t INDEX_VERSION = 1;
+static constexpr size_t INDEX_HEADER_SIZE = 16;
+
+enum class RecordType : uint8_t {
+    Add = 1,
+    Remove = 2,
+};
+
+// Read-only view of a whole file
+class MappedFile final {
+protected:
+    char const* m_data = nullptr;
+    size_t m_size = 0;
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#endif
+
+public:
+    MappedFile(std::filesystem::path const& path) {
+#ifdef _WIN32
+        m_file = CreateFileW(
+            path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+        );
+        if (m_file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+            return;
+        }
+        m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping) {
+            return;
+        }
+        m_data = static_cast<char const*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (m_data) {
+            m_size = static_cast<size_t>(size.QuadPart);
+        }
+#else
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            auto data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                m_data = static_cast<char const*>(data);
+                m_size = info.st_size;
+            }
+        }
+        // The mapping stays valid after the file is closed
+        ::close(fd);
+#endif
+    }
+    ~MappedFile() {
+#ifdef _WIN32
+        if (m_data) {
+            UnmapViewOfFile(m_data);
+        }
+        if (m_mapping) {
+            CloseHandle(m_mapping);
+        }
+        if (m_file != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_file);
+        }
+#else
+        if (m_data) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+#endif
+    }
+
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    std::string_view view() const {
+        return std::string_view(m_data ? m_data : "", m_size);
+    }
+};
+
+template <class T>
+static void writeLE(std::string& out, T value) {
+    for (size_t i = 0; i < sizeof(T); i += 1) {
+        out.push_back(static_cast<char>((static_cast<uint64_t>(value) >> (i * 8)) & 0xff));
+    }
+}
+template <class T>
+static T readLE(std::string_view data, size_t offset) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(T); i += 1) {
+        value |= static_cast<uint64_t>(static_cast<uint8_t>(data[offset + i])) << (i * 8);
+    }
+    return static_cast<T>(value);
+}
+
+static std::string encodeHeader(uint64_t generation) {
+    std::string header(INDEX_MAGIC);
+    writeLE<uint32_t>(header, INDEX_VERSION);
+    writeLE<uint64_t>(header, generation);
+    return header;
+}
+static void encodeRecord(std::string& out, RecordType type, PackStore::Entry const& entry) {
+    std::string payload;
+    payload.push_back(static_cast<char>(type));
+    writeLE<uint64_t>(payload, entry.offset);
+    writeLE<uint64_t>(payload, entry.length);
+    writeLE<uint16_t>(payload, entry.id.size());
+    payload += entry.id;
+    writeLE<uint32_t>(payload, entry.metadata.size());
+    payload += entry.metadata;
+
+    writeLE<uint32_t>(out, payload.size());
+    writeLE<uint32_t>(out, crc32(0, reinterpret_cast<Bytef const*>(payload.data()), payload.size()));
+    out += payload;
+}
+
+// A record in the index, pointing into wherever the index is
+struct Record final {
+    RecordType type;
+    uint64_t offset;
+    uint64_t length;
+    std::string_view id;
+    std::string_view metadata;
+
+    PackStore::Entry toEntry() const {
+        return PackStore::Entry { std::string(id), offset, length, std::string(metadata) };
+    }
+};
+
+// Type, offset, length and the ID's size
+static constexpr size_t RECORD_FIXED_SIZE = 1 + 8 + 8 + 2;
+
+// Read the record at `offset`, which has already been checked by decodeRecord
+static Record readRecord(std::string_view data, size_t offset) {
+    auto payload = data.substr(offset + 8, readLE<uint32_t>(data, offset));
+    auto idSize = readLE<uint16_t>(payload, 17);
+    auto metaSize = readLE<uint32_t>(payload, RECORD_FIXED_SIZE + idSize);
+    return Record {
+        static_cast<RecordType>(payload[0]),
+        readLE<uint64_t>(payload, 1),
+        readLE<uint64_t>(payload, 9),
+        payload.substr(RECORD_FIXED_SIZE, idSize),
+        payload.substr(RECORD_FIXED_SIZE + idSize + 4, metaSize),
+    };
+}
+// Check and read the record at `offset`, returning the offset of the next 
+// one, or nullopt if the record is cut off or corrupt
+static std::optional<size_t> decodeRecord(std::string_view data, size_t offset, Record& record) {
+    if (data.size() - offset < 8) {
+        return std::nullopt;
+    }
+    auto size = readLE<uint32_t>(data, offset);
+    auto crc = readLE<uint32_t>(data, offset + 4);
+    if (data.size() - offset - 8 < size) {
+        return std::nullopt;
+    }
+    auto payload = data.substr(offset + 8, size);
+    if (crc32(0, reinterpret_cast<Bytef const*>(payload.data()), payload.size()) != crc) {
+        return std::nullopt;
+    }
+    if (payload.size() < RECORD_FIXED_SIZE) {
+        return std::nullopt;
+    }
+    auto idSize = readLE<uint16_t>(payload, 17);
+    if (payload.size() < RECORD_FIXED_SIZE + idSize + 4) {
+        return std::nullopt;
+    }
+    auto metaSize = readLE<uint32_t>(payload, RECORD_FIXED_SIZE + idSize);
+    if (payload.size() < RECORD_FIXED_SIZE + idSize + 4 + metaSize) {
+        return std::nullopt;
+    }
+    record = readRecord(data, offset);
+    return offset + 8 + size;
+}
+
+// Write a whole file and sync it
+static bool writeSynced(std::filesystem::path const& path, std::string_view data) {
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.write(data.data(), data.size())) {
+            return false;
+        }
+    }
+    return syncFile(path);
+}
+
+PackStore::PackStore(std::filesystem::path const& base) : m_base(base) {}
+PackStore::~PackStore() = default;
+
+std::filesystem::path PackStore::getPackPath(uint64_t generation) const {
+    auto path = m_base;
+    path += "-";
+    path += std::to_string(generation);
+    path += ".pack";
+    return path;
+}
+std::filesystem::path PackStore::getIndexPath() const {
+    auto path = m_base;
+    path += ".idx";
+    return path;
+}
+
+// Once more records than this have been appended after the sorted ones, 
+// the index is rewritten when it's next opened
+static size_t maxAppended(size_t sorted) {
+    return std::max<size_t>(256, sorted / 4);
+}
+
+bool PackStore::load() {
+    std::error_code ec;
+    auto indexPath = this->getIndexPath();
+    if (!std::filesystem::exists(indexPath, ec)) {
+        std::filesystem::create_directories(m_base.parent_path(), ec);
+        if (!writeSynced(indexPath, encodeHeader(0))) {
+            return false;
+        }
+        syncDirectory(m_base.parent_path());
+    }
+
+    m_index = std::make_unique<MappedFile>(indexPath);
+    auto data = m_index->view();
+    if (data.size() < INDEX_HEADER_SIZE || data.substr(0, 4) != INDEX_MAGIC || readLE<uint32_t>(data, 4) != INDEX_VERSION) {
+        m_index.reset();
+        return false;
+    }
+    m_generation = readLE<uint64_t>(data, 8);
+    m_sorted.clear();
+    m_appended.clear();
+
+    // Records are sorted up to the first one that's out of order or not an 
+    // add, and everything from there on is kept in memory
+    size_t offset = INDEX_HEADER_SIZE;
+    Record record;
+    bool sorted = true;
+    std::string_view lastID;
+    while (auto next = decodeRecord(data, offset, record)) {
+        sorted = sorted && record.type == RecordType::Add && (m_sorted.empty() || record.id > lastID);
+        if (sorted) {
+            m_sorted.push_back(offset);
+            lastID = record.id;
+        }
+        else if (record.type == RecordType::Add) {
+            m_appended.insert_or_assign(std::string(record.id), record.toEntry());
+        }
+        else {
+            m_appended.insert_or_assign(std::string(record.id), std::nullopt);
+        }
+        offset = *next;
+    }
+    // Drop a torn record at the end so new ones don't end up after it. The 
+    // records before it stay where they are
+    if (offset != data.size()) {
+        m_index.reset();
+        std::filesystem::resize_file(indexPath, offset, ec);
+        if (ec) {
+            return false;
+        }
+        m_index = std::make_unique<MappedFile>(indexPath);
+    }
+
+    auto packPath = this->getPackPath(m_generation);
+    m_packSize = std::filesystem::exists(packPath, ec) ? std::filesystem::file_size(packPath, ec) : 0;
+    auto entries = this->collectEntries();
+    m_liveSize = 0;
+    for (auto& entry : entries) {
+        m_liveSize += entry.length;
+    }
+    // The index still works as it is if this fails
+    if (m_appended.size() > maxAppended(m_sorted.size())) {
+        this->rewriteIndex(m_generation, entries);
+    }
+
+    // Packs of other generations are left over from a compaction that was
+    // interrupted before or after swapping the index
+    auto prefix = m_base.filename().string() + "-";
+    for (auto& file : std::filesystem::directory_iterator(m_base.parent_path(), ec)) {
+        auto filename = file.path().filename().string();
+        if (filename.starts_with(prefix) && filename.ends_with(".pack") && file.path() != packPath) {
+            std::filesystem::remove(file.path(), ec);
+        }
+    }
+    return true;
+}
+
+bool PackStore::rewriteIndex(uint64_t generation, std::vector<Entry> const& entries) {
+    auto index = encodeHeader(generation);
+    std::vector<size_t> sorted;
+    sorted.reserve(entries.size());
+    for (auto& entry : entries) {
+        sorted.push_back(index.size());
+        encodeRecord(index, RecordType::Add, entry);
+    }
+    auto indexPath = this->getIndexPath();
+    auto tmpPath = indexPath;
+    tmpPath += ".tmp";
+    std::error_code ec;
+    if (!writeSynced(tmpPath, index)) {
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    // Windows won't replace a file that's mapped
+    m_index.reset();
+    std::filesystem::rename(tmpPath, indexPath, ec);
+    m_index = std::make_unique<MappedFile>(indexPath);
+    if (ec) {
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    syncDirectory(m_base.parent_path());
+    m_sorted = std::move(sorted);
+    m_appended.clear();
+    return true;
+}
+
+std::optional<PackStore::Entry> PackStore::find(std::string_view id) const {
+    if (!m_index) {
+        return std::nullopt;
+    }
+    auto appended = m_appended.find(id);
+    if (appended != m_appended.end()) {
+        return appended->second;
+    }
+    auto data = m_index->view();
+    auto it = std::lower_bound(m_sorted.begin(), m_sorted.end(), id, [&](size_t offset, std::string_view id) {
+        return readRecord(data, offset).id < id;
+    });
+    if (it == m_sorted.end()) {
+        return std::nullopt;
+    }
+    auto record = readRecord(data, *it);
+    if (record.id != id) {
+        return std::nullopt;
+    }
+    return record.toEntry();
+}
+
+std::vector<PackStore::Entry> PackStore::collectEntries() const {
+    std::vector<Entry> entries;
+    if (!m_index) {
+        return entries;
+    }
+    entries.reserve(m_sorted.size() + m_appended.size());
+    // Both are sorted, so merge them
+    auto data = m_index->view();
+    auto appended = m_appended.begin();
+    auto const takeAppended = [&] {
+        if (appended->second) {
+            entries.push_back(*appended->second);
+        }
+        ++appended;
+    };
+    for (auto offset : m_sorted) {
+        auto record = readRecord(data, offset);
+        while (appended != m_appended.end() && appended->first < record.id) {
+            takeAppended();
+        }
+        // Replaced or removed since
+        if (appended != m_appended.end() && appended->first == record.id) {
+            takeAppended();
+            continue;
+        }
+        entries.push_back(record.toEntry());
+    }
+    while (appended != m_appended.end()) {
+        takeAppended();
+    }
+    return entries;
+}
+
+bool PackStore::exists() const {
+    std::error_code ec;
+    return std::filesystem::exists(this->getIndexPath(), ec);
+}
+bool PackStore::open() {
+    std::lock_guard lock(m_mutex);
+    if (!m_open) {
+        m_open = this->load();
+    }
+    return m_open;
+}
+bool PackStore::isOpen() const {
+    std::lock_guard lock(m_mutex);
+    return m_open;
+}
+void PackStore::close() {
+    std::lock_guard compactLock(m_compactMutex);
+    std::lock_guard lock(m_mutex);
+    m_open = false;
+    m_index.reset();
+    m_sorted.clear();
+    m_appended.clear();
+    m_packSize = 0;
+    m_liveSize = 0;
+}
+
+std::vector<PackStore::Entry> PackStore::getEntries() const {
+    std::lock_guard lock(m_mutex);
+    return this->collectEntries();
+}
+std::optional<PackStore::Entry> PackStore::getEntry(std::string const& id) const {
+    std::lock_guard lock(m_mutex);
+    return this->find(id);
+}
+bool PackStore::contains(std::string const& id) const {
+    std::lock_guard lock(m_mutex);
+    return this->find(id).has_value();
+}
+
+std::optional<std::string> PackStore::read(std::string const& id) const {
+    // Held throughout so a compaction can't delete the pack mid-read
+    std::lock_guard lock(m_mutex);
+    auto entry = this->find(id);
+    if (!entry) {
+        return std::nullopt;
+    }
+    std::ifstream file(this->getPackPath(m_generation), std::ios::binary);
+    std::string data(entry->length, '\0');
+    if (!file.seekg(entry->offset) || !file.read(data.data(), data.size())) {
+        return std::nullopt;
+    }
+    return data;
+}
+
+bool PackStore::appendRecords(std::string const& records) {
+    auto path = this->getIndexPath();
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::app);
+        if (!file.write(records.data(), records.size())) {
+            return false;
+        }
+    }
+    return syncFile(path);
+}
+
+bool PackStore::add(std::vector<Blob> const& blobs) {
+    std::lock_guard lock(m_mutex);
+    if (!m_open || blobs.empty()) {
+        return m_open;
+    }
+    auto packPath = this->getPackPath(m_generation);
+    // Start from the actual end of the pack, which is past the last indexed
+    // blob if an earlier add failed halfway
+    std::error_code ec;
+    auto offset = std::filesystem::exists(packPath, ec) ? std::filesystem::file_size(packPath, ec) : 0;
+
+    std::vector<Entry> added;
+    std::string records;
+    {
+        std::ofstream file(packPath, std::ios::binary | std::ios::app);
+        for (auto& blob : blobs) {
+            if (!file.write(blob.data.data(), blob.data.size())) {
+                return false;
+            }
+            auto& entry = added.emplace_back(Entry { blob.id, offset, blob.data.size(), blob.metadata });
+            encodeRecord(records, RecordType::Add, entry);
+            offset += blob.data.size();
+        }
+    }
+    // The blobs have to be on disk before the records pointing to them
+    if (!syncFile(packPath) || !this->appendRecords(records)) {
+        return false;
+    }
+
+    m_packSize = offset;
+    for (auto& entry : added) {
+        if (auto old = this->find(entry.id)) {
+            m_liveSize -= old->length;
+        }
+        m_liveSize += entry.length;
+        m_appended.insert_or_assign(entry.id, entry);
+    }
+    return true;
+}
+
+bool PackStore::remove(std::vector<std::string> const& ids) {
+    std::lock_guard lock(m_mutex);
+    if (!m_open) {
+        return false;
+    }
+    std::string records;
+    std::vector<Entry> removed;
+    for (auto& id : ids) {
+        if (auto entry = this->find(id)) {
+            encodeRecord(records, RecordType::Remove, Entry { id, 0, 0, "" });
+            removed.push_back(std::move(*entry));
+        }
+    }
+    if (records.empty()) {
+        return true;
+    }
+    if (!this->appendRecords(records)) {
+        return false;
+    }
+    for (auto& entry : removed) {
+        // The same ID may have been passed twice
+        if (this->find(entry.id)) {
+            m_liveSize -= entry.length;
+            m_appended.insert_or_assign(entry.id, std::nullopt);
+        }
+    }
+    return true;
+}
+
+uint64_t PackStore::getGarbageSize() const {
+    std::lock_guard lock(m_mutex);
+    return m_packSize - m_liveSize;
+}
+bool PackStore::shouldCompact() const {
+    std::lock_guard lock(m_mutex);
+    auto garbage = m_packSize - m_liveSize;
+    return garbage > 1024 * 1024 && garbage * 2 > m_packSize;
+}
+
+bool PackStore::compact() {
+    std::lock_guard compactLock(m_compactMutex);
+    std::map<std::string, Entry> snapshot;
+    uint64_t generation;
+    {
+        std::lock_guard lock(m_mutex);
+        if (!m_open) {
+            return false;
+        }
+        for (auto& entry : this->collectEntries()) {
+            snapshot.insert({ entry.id, entry });
+        }
+        generation = m_generation;
+    }
+    auto oldPack = this->getPackPath(generation);
+    auto newPack = this->getPackPath(generation + 1);
+
+    // Copy the live blobs without holding the lock; the old pack is only
+    // appended to in the meantime, so the snapshot's offsets stay valid
+    std::ifstream in(oldPack, std::ios::binary);
+    std::ofstream out(newPack, std::ios::binary | std::ios::trunc);
+    auto copy = [&](Entry const& entry, uint64_t& offset) -> std::optional<Entry> {
+        std::string data(entry.length, '\0');
+        in.clear();
+        if (!in.seekg(entry.offset) || !in.read(data.data(), data.size()) || !out.write(data.data(), data.size())) {
+            return std::nullopt;
+        }
+        auto moved = entry;
+        moved.offset = offset;
+        offset += entry.length;
+        return moved;
+    };
+    uint64_t offset = 0;
+    std::map<std::string, Entry> moved;
+    for (auto& [id, entry] : snapshot) {
+        auto res = copy(entry, offset);
+        if (!res) {
+            std::error_code ec;
+            out.close();
+            std::filesystem::remove(newPack, ec);
+            return false;
+        }
+        moved.insert({ id, *res });
+    }
+
+    std::lock_guard lock(m_mutex);
+    // Catch up with whatever was added or removed while copying
+    std::vector<Entry> entries;
+    bool ok = true;
+    for (auto& entry : this->collectEntries()) {
+        auto old = snapshot.find(entry.id);
+        if (old != snapshot.end() && old->second.offset == entry.offset) {
+            entries.push_back(moved.at(entry.id));
+        }
+        else if (auto res = copy(entry, offset)) {
+            entries.push_back(std::move(*res));
+        }
+        else {
+            ok = false;
+            break;
+        }
+    }
+    out.close();
+    std::error_code ec;
+    if (!ok || !syncFile(newPack)) {
+        std::filesystem::remove(newPack, ec);
+        return false;
+    }
+    // This is the point where the new generation takes over
+    if (!this->rewriteIndex(generation + 1, entries)) {
+        std::filesystem::remove(newPack, ec);
+        return false;
+    }
+
+    m_generation = generation + 1;
+    m_packSize = offset;
+    m_liveSize = offset;
+    in.close();
+    std::filesystem::remove(oldPack, ec);
+    return true;
+}
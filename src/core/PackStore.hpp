@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class MappedFile;
+
+/**
+ * Append-only archive of blobs by ID, made of two files next to each other:
+ *  - `<base>-N.pack` holds the blobs back to back (N is the generation,
+ *    which goes up every time the archive is compacted)
+ *  - `<base>.idx` is a header followed by a record for every blob added
+ *    (its ID, offset, length and a small metadata string) or removed (a
+ *    tombstone). The latest record for an ID wins
+ *
+ * The index is memory-mapped when the archive is opened, so listing what's
+ * in it never touches the blobs. Both files are only ever appended to and
+ * records are checksummed, so a torn write at the end is simply ignored.
+ * Removed blobs stay in the pack until it's compacted, which copies the live
+ * blobs into the next generation's pack and then swaps in a new index with
+ * a single rename.
+ *
+ * A rewritten index has its records sorted by ID, and those are looked up 
+ * by binary searching the mapped file in place. Only the records appended 
+ * after them are kept in memory; once there are too many of those, the 
+ * index is rewritten the next time the archive is opened.
+ *
+ * All methods are thread safe
+ */
+class PackStore final {
+public:
+    struct Entry final {
+        std::string id;
+        uint64_t offset = 0;
+        uint64_t length = 0;
+        std::string metadata;
+    };
+    struct Blob final {
+        std::string id;
+        std::string_view data;
+        std::string metadata;
+    };
+
+protected:
+    std::filesystem::path m_base;
+    mutable std::mutex m_mutex;
+    // Only one compaction may run at a time
+    std::mutex m_compactMutex;
+    bool m_open = false;
+    uint64_t m_generation = 0;
+    std::unique_ptr<MappedFile> m_index;
+    // Offsets of the sorted records at the start of the index
+    std::vector<size_t> m_sorted;
+    // Records appended after those, by ID (nullopt if it was removed)
+    std::map<std::string, std::optional<Entry>, std::less<>> m_appended;
+    uint64_t m_packSize = 0;
+    uint64_t m_liveSize = 0;
+
+    std::filesystem::path getPackPath(uint64_t generation) const;
+    std::filesystem::path getIndexPath() const;
+    bool load();
+    bool appendRecords(std::string const& records);
+    // Replace the index with one that has all of `entries` (sorted by ID) 
+    // in sorted records, and map it
+    bool rewriteIndex(uint64_t generation, std::vector<Entry> const& entries);
+    // These need m_mutex held
+    std::optional<Entry> find(std::string_view id) const;
+    std::vector<Entry> collectEntries() const;
+
+public:
+    // `base` is the path of the files without their extension
+    PackStore(std::filesystem::path const& base);
+    ~PackStore();
+
+    PackStore(PackStore const&) = delete;
+    PackStore& operator=(PackStore const&) = delete;
+
+    // Whether the archive has been created
+    bool exists() const;
+    // Open the archive, creating it if it doesn't exist yet. Returns false
+    // if it couldn't be read or created
+    bool open();
+    bool isOpen() const;
+    // Forget the archive's contents, for example after its files have been
+    // deleted. It's reopened by the next call to open
+    void close();
+
+    std::vector<Entry> getEntries() const;
+    std::optional<Entry> getEntry(std::string const& id) const;
+    bool contains(std::string const& id) const;
+    std::optional<std::string> read(std::string const& id) const;
+
+    // Append blobs (replacing ones with the same ID) and sync them to disk
+    // together
+    bool add(std::vector<Blob> const& blobs);
+    bool remove(std::vector<std::string> const& ids);
+
+    // Bytes taken up by removed or replaced blobs
+    uint64_t getGarbageSize() const;
+    // Whether enough of the pack is garbage to be worth compacting
+    bool shouldCompact() const;
+    bool compact();
+};
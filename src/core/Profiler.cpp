@@ -0,0 +1,127 @@
+#include "Profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+
+static auto const PROFILER_EPOCH = std::chrono::steady_clock::now();
+
+// Small sequential IDs read better in trace viewers than hashed thread IDs
+static uint32_t getThreadNumber() {
+    static std::atomic_uint32_t nextThread = 0;
+    thread_local uint32_t thread = nextThread++;
+    return thread;
+}
+
+Profiler::Profiler() {
+    m_spans.resize(CAPACITY);
+}
+
+Profiler* Profiler::get() {
+    static auto inst = new Profiler();
+    return inst;
+}
+
+int64_t Profiler::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - PROFILER_EPOCH
+    ).count();
+}
+
+void Profiler::setEnabled(bool enabled) {
+    m_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void Profiler::record(char const* name, int64_t start, int64_t end) {
+    if (!this->isEnabled()) {
+        return;
+    }
+    auto thread = getThreadNumber();
+    std::lock_guard lock(m_mutex);
+    m_spans[m_next] = ProfileSpan { name, start, end - start, thread };
+    m_next += 1;
+    if (m_next == CAPACITY) {
+        m_next = 0;
+        m_wrapped = true;
+    }
+}
+
+void Profiler::clear() {
+    std::lock_guard lock(m_mutex);
+    m_next = 0;
+    m_wrapped = false;
+}
+
+std::vector<ProfileSpan> Profiler::getSpans() {
+    std::lock_guard lock(m_mutex);
+    std::vector<ProfileSpan> spans;
+    if (m_wrapped) {
+        spans.insert(spans.end(), m_spans.begin() + m_next, m_spans.end());
+    }
+    spans.insert(spans.end(), m_spans.begin(), m_spans.begin() + m_next);
+    return spans;
+}
+
+std::vector<ProfileSummary> Profiler::summarize() {
+    // Names are literals, but the same literal may have different addresses 
+    // in different translation units, so group by contents
+    std::unordered_map<std::string_view, std::vector<double>> durations;
+    for (auto& span : this->getSpans()) {
+        durations[span.name].push_back(span.duration / 1000.0);
+    }
+    std::vector<ProfileSummary> res;
+    for (auto& [name, times] : durations) {
+        std::sort(times.begin(), times.end());
+        ProfileSummary summary;
+        summary.name = name.data();
+        summary.count = times.size();
+        for (auto time : times) {
+            summary.totalMs += time;
+        }
+        summary.meanMs = summary.totalMs / times.size();
+        summary.p90Ms = times[std::min(times.size() - 1, times.size() * 9 / 10)];
+        summary.maxMs = times.back();
+        res.push_back(summary);
+    }
+    std::sort(res.begin(), res.end(), [](auto const& a, auto const& b) {
+        return a.totalMs > b.totalMs;
+    });
+    return res;
+}
+
+static void appendJSONString(std::string& out, std::string_view str) {
+    out += '"';
+    for (auto c : str) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            default: out += c; break;
+        }
+    }
+    out += '"';
+}
+
+std::string Profiler::toChromeTrace() {
+    auto spans = this->getSpans();
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    out.reserve(out.size() + spans.size() * 96);
+    bool first = true;
+    for (auto& span : spans) {
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        out += "{\"name\":";
+        appendJSONString(out, span.name);
+        out += ",\"cat\":\"bettersave\",\"ph\":\"X\",\"pid\":1,\"tid\":";
+        out += std::to_string(span.thread);
+        out += ",\"ts\":";
+        out += std::to_string(span.start);
+        out += ",\"dur\":";
+        out += std::to_string(span.duration);
+        out += '}';
+    }
+    out += "]}";
+    return out;
+}
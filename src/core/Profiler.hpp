@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A timed section of code
+struct ProfileSpan final {
+    // Must be a string literal (or otherwise live forever)
+    char const* name = nullptr;
+    // Microseconds since the profiler was created
+    int64_t start = 0;
+    int64_t duration = 0;
+    uint32_t thread = 0;
+};
+
+// Stats of every recorded span with the same name
+struct ProfileSummary final {
+    char const* name = nullptr;
+    size_t count = 0;
+    double totalMs = 0;
+    double meanMs = 0;
+    double p90Ms = 0;
+    double maxMs = 0;
+};
+
+/**
+ * Records timing spans into a fixed size ring buffer, which can be exported 
+ * as Chrome trace event JSON (open in chrome://tracing or Perfetto). While 
+ * disabled, spans cost a single relaxed atomic load
+ */
+class Profiler final {
+protected:
+    std::atomic_bool m_enabled = false;
+    std::mutex m_mutex;
+    std::vector<ProfileSpan> m_spans;
+    size_t m_next = 0;
+    bool m_wrapped = false;
+
+    Profiler();
+
+public:
+    static constexpr size_t CAPACITY = 16384;
+
+    static Profiler* get();
+    // Microseconds since the profiler was created
+    static int64_t now();
+
+    bool isEnabled() const {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+    void setEnabled(bool enabled);
+
+    // Does nothing while disabled
+    void record(char const* name, int64_t start, int64_t end);
+    void clear();
+
+    // Recorded spans, oldest first
+    std::vector<ProfileSpan> getSpans();
+    // Per-name stats, slowest total first
+    std::vector<ProfileSummary> summarize();
+    std::string toChromeTrace();
+};
+
+// Times the scope it lives in
+class ProfileScope final {
+protected:
+    char const* m_name;
+    int64_t m_start = 0;
+
+public:
+    explicit ProfileScope(char const* name)
+      : m_name(Profiler::get()->isEnabled() ? name : nullptr)
+    {
+        if (m_name) {
+            m_start = Profiler::now();
+        }
+    }
+    ~ProfileScope() {
+        if (m_name) {
+            Profiler::get()->record(m_name, m_start, Profiler::now());
+        }
+    }
+
+    ProfileScope(ProfileScope const&) = delete;
+    ProfileScope& operator=(ProfileScope const&) = delete;
+};
+
+#define BETTERSAVE_PROFILE_CONCAT2(a, b) a##b
+#define BETTERSAVE_PROFILE_CONCAT(a, b) BETTERSAVE_PROFILE_CONCAT2(a, b)
+
+#ifdef BETTERSAVE_NO_PROFILING
+    #define BETTERSAVE_PROFILE(name)
+#else
+    // Time the rest of the current scope
+    #define BETTERSAVE_PROFILE(name) \
+        ProfileScope BETTERSAVE_PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#endif
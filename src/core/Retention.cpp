@@ -0,0 +1,37 @@
+#include "Retention.hpp"
+#include <algorithm>
+#include <numeric>
+
+std::vector<size_t> selectExpired(std::vector<RetentionItem> const& items, RetentionLimits const& limits, int64_t now) {
+    std::vector<size_t> expired;
+    if (limits.isUnlimited()) {
+        return expired;
+    }
+
+    std::vector<size_t> order(items.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return items[a].time < items[b].time;
+    });
+
+    uintmax_t totalSize = 0;
+    for (auto& item : items) {
+        totalSize += item.size;
+    }
+    size_t count = items.size();
+
+    for (auto i : order) {
+        auto& item = items[i];
+        auto tooOld = limits.maxAge && now - item.time > limits.maxAge;
+        auto tooMany = limits.maxCount && count > limits.maxCount;
+        auto tooBig = limits.maxTotalSize && totalSize > limits.maxTotalSize;
+        // Everything after this is newer, and removing it wouldn't be needed
+        if (!tooOld && !tooMany && !tooBig) {
+            break;
+        }
+        expired.push_back(i);
+        count -= 1;
+        totalSize -= item.size;
+    }
+    return expired;
+}
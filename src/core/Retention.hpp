@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Limits on what the trash keeps; 0 means no limit
+struct RetentionLimits final {
+    uintmax_t maxTotalSize = 0;
+    // In seconds
+    int64_t maxAge = 0;
+    size_t maxCount = 0;
+
+    bool isUnlimited() const {
+        return !maxTotalSize && !maxAge && !maxCount;
+    }
+};
+
+struct RetentionItem final {
+    uintmax_t size = 0;
+    // Unix timestamp (seconds) of when the item was trashed
+    int64_t time = 0;
+};
+
+/**
+ * Pick the items that have to go for the rest to fit within the limits: 
+ * everything older than the maximum age, and then the oldest remaining items 
+ * until both the count and the total size fit. Returns indices into `items`, 
+ * oldest first
+ */
+std::vector<size_t> selectExpired(std::vector<RetentionItem> const& items, RetentionLimits const& limits, int64_t now);
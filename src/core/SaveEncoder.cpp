@@ -0,0 +1,142 @@
+#include "SaveEncoder.hpp"
+#include "WorkerPool.hpp"
+#include "Profiler.hpp"
+#include <zlib.h>
+#include <vector>
+#include <functional>
+
+// Chunks are cut at the start of an array item (a level or a list) once they
+// are at least this big; cutting at content rather than at fixed offsets
+// means an edit to one level doesn't shift the chunks after it
+static constexpr size_t MIN_CHUNK_SIZE = 64 * 1024;
+static constexpr std::string_view CHUNK_BOUNDARY = "<k>k_";
+
+// An empty final deflate block, to end a stream made of sync flushed chunks
+static constexpr unsigned char DEFLATE_END[] = { 0x03, 0x00 };
+
+static constexpr char BASE64_URL_CHARS[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+SaveEncoder* SaveEncoder::get() {
+    static auto inst = new SaveEncoder();
+    return inst;
+}
+
+static std::vector<std::string_view> splitChunks(std::string_view plist) {
+    std::vector<std::string_view> chunks;
+    size_t start = 0;
+    while (start < plist.size()) {
+        auto end = plist.find(CHUNK_BOUNDARY, start + MIN_CHUNK_SIZE);
+        if (end == std::string_view::npos) {
+            end = plist.size();
+        }
+        chunks.push_back(plist.substr(start, end - start));
+        start = end;
+    }
+    return chunks;
+}
+
+// Deflate a chunk as raw deflate ending in a sync flush, so it starts and
+// ends on a byte boundary and can be concatenated with other chunks
+static std::string deflateChunk(std::string_view data) {
+    z_stream stream {};
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    std::string out;
+    out.resize(deflateBound(&stream, data.size()) + 16);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = static_cast<uInt>(out.size());
+    deflate(&stream, Z_SYNC_FLUSH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+static void writeU32LE(std::string& out, uint32_t value) {
+    for (size_t i = 0; i < 4; i += 1) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+static void encodeBase64(std::string_view in, char* out, uint8_t xorKey) {
+    size_t i = 0;
+    for (; i + 2 < in.size(); i += 3) {
+        uint32_t n = (static_cast<uint8_t>(in[i]) << 16) | (static_cast<uint8_t>(in[i + 1]) << 8) | static_cast<uint8_t>(in[i + 2]);
+        *out++ = BASE64_URL_CHARS[(n >> 18) & 63] ^ xorKey;
+        *out++ = BASE64_URL_CHARS[(n >> 12) & 63] ^ xorKey;
+        *out++ = BASE64_URL_CHARS[(n >> 6) & 63] ^ xorKey;
+        *out++ = BASE64_URL_CHARS[n & 63] ^ xorKey;
+    }
+    if (auto rest = in.size() - i) {
+        uint32_t n = static_cast<uint8_t>(in[i]) << 16;
+        if (rest == 2) {
+            n |= static_cast<uint8_t>(in[i + 1]) << 8;
+        }
+        *out++ = BASE64_URL_CHARS[(n >> 18) & 63] ^ xorKey;
+        *out++ = BASE64_URL_CHARS[(n >> 12) & 63] ^ xorKey;
+        *out++ = (rest == 2 ? BASE64_URL_CHARS[(n >> 6) & 63] : '=') ^ xorKey;
+        *out++ = '=' ^ xorKey;
+    }
+}
+
+std::string SaveEncoder::encode(std::string_view plist, uint8_t xorKey) {
+    BETTERSAVE_PROFILE("SaveEncoder::encode");
+    auto pool = WorkerPool::get();
+    auto pieces = splitChunks(plist);
+
+    // Compress every chunk that wasn't in the previous save
+    std::vector<uint64_t> hashes(pieces.size());
+    std::vector<Chunk> chunks(pieces.size());
+    pool->parallelFor(pieces.size(), [&](size_t i) {
+        auto piece = pieces[i];
+        hashes[i] = std::hash<std::string_view>()(piece);
+        auto crc = static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>(piece.data()), static_cast<uInt>(piece.size())));
+        // The cache is only read while chunks are being compressed
+        auto cached = m_cache.find(hashes[i]);
+        if (cached != m_cache.end() && cached->second.crc == crc && cached->second.size == piece.size()) {
+            chunks[i] = cached->second;
+        }
+        else {
+            chunks[i] = Chunk { deflateChunk(piece), crc, piece.size() };
+        }
+    });
+
+    // Join into a single gzip stream
+    std::string gzip;
+    size_t gzipSize = 10 + sizeof(DEFLATE_END) + 8;
+    for (auto& chunk : chunks) {
+        gzipSize += chunk.deflated.size();
+    }
+    gzip.reserve(gzipSize);
+    gzip.append("\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\xff", 10);
+    uint32_t crc = static_cast<uint32_t>(crc32(0, nullptr, 0));
+    for (auto& chunk : chunks) {
+        gzip += chunk.deflated;
+        crc = static_cast<uint32_t>(crc32_combine(crc, chunk.crc, static_cast<z_off_t>(chunk.size)));
+    }
+    gzip.append(reinterpret_cast<const char*>(DEFLATE_END), sizeof(DEFLATE_END));
+    writeU32LE(gzip, crc);
+    writeU32LE(gzip, static_cast<uint32_t>(plist.size()));
+
+    // Keep this save's chunks for the next one
+    std::unordered_map<uint64_t, Chunk> cache;
+    cache.reserve(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i += 1) {
+        cache.try_emplace(hashes[i], std::move(chunks[i]));
+    }
+    m_cache = std::move(cache);
+
+    // Base64 encode in parallel; segments are a multiple of 3 bytes long so
+    // each maps to its own part of the output
+    static constexpr size_t SEGMENT_SIZE = 3 * 256 * 1024;
+    std::string out;
+    out.resize((gzip.size() + 2) / 3 * 4);
+    auto segments = (gzip.size() + SEGMENT_SIZE - 1) / SEGMENT_SIZE;
+    pool->parallelFor(segments, [&](size_t i) {
+        auto start = i * SEGMENT_SIZE;
+        auto segment = std::string_view(gzip).substr(start, SEGMENT_SIZE);
+        encodeBase64(segment, out.data() + start / 3 * 4, xorKey);
+    });
+    return out;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
+
+/**
+ * Encodes GD save files (gzip + URL-safe base64, optionally XORed) in
+ * parallel on the worker pool. The plist is split into chunks at level
+ * boundaries, which are deflated independently and joined into a single
+ * gzip stream, so the result can be read by vanilla GD.
+ *
+ * Compressed chunks are kept around until the next encode, so levels that
+ * haven't changed since the last save don't need to be compressed again
+ */
+class SaveEncoder final {
+protected:
+    struct Chunk final {
+        std::string deflated;
+        uint32_t crc = 0;
+        size_t size = 0;
+    };
+    // Chunks from the previous encode, by their contents' hash
+    std::unordered_map<uint64_t, Chunk> m_cache;
+
+    SaveEncoder() = default;
+
+public:
+    static SaveEncoder* get();
+
+    // Encode a save file's plist. A `xorKey` of 0 means the output isn't XORed
+    std::string encode(std::string_view plist, uint8_t xorKey);
+};
@@ -0,0 +1,135 @@
+#include "SearchIndex.hpp"
+#include <algorithm>
+#include <optional>
+
+static constexpr size_t TRIGRAM = 3;
+
+static uint32_t trigramAt(std::string const& text, size_t i) {
+    return static_cast<uint8_t>(text[i]) << 16 | static_cast<uint8_t>(text[i + 1]) << 8 | static_cast<uint8_t>(text[i + 2]);
+}
+
+static bool isWordChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+}
+
+// Find the query in the text, and whether any occurrence starts a word
+static std::optional<bool> findIn(std::string const& text, std::string const& query) {
+    auto pos = text.find(query);
+    if (pos == std::string::npos) {
+        return std::nullopt;
+    }
+    for (; pos != std::string::npos; pos = text.find(query, pos + 1)) {
+        if (pos == 0 || !isWordChar(text[pos - 1])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string SearchIndex::normalize(std::string_view text) {
+    std::string res(text);
+    for (auto& c : res) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+    }
+    return res;
+}
+
+SearchIndex::DocID SearchIndex::add(std::string_view text) {
+    auto id = static_cast<DocID>(m_docs.size());
+    auto& doc = m_docs.emplace_back(Doc { normalize(text), true });
+    for (size_t i = 0; i + TRIGRAM <= doc.text.size(); i += 1) {
+        auto& posting = m_postings[trigramAt(doc.text, i)];
+        // The same trigram may appear more than once in a name
+        if (posting.empty() || posting.back() != id) {
+            posting.push_back(id);
+        }
+    }
+    m_count += 1;
+    return id;
+}
+
+void SearchIndex::remove(DocID id) {
+    if (id >= m_docs.size() || !m_docs[id].alive) {
+        return;
+    }
+    auto& doc = m_docs[id];
+    for (size_t i = 0; i + TRIGRAM <= doc.text.size(); i += 1) {
+        auto it = m_postings.find(trigramAt(doc.text, i));
+        if (it == m_postings.end()) {
+            continue;
+        }
+        auto& posting = it->second;
+        auto pos = std::lower_bound(posting.begin(), posting.end(), id);
+        if (pos != posting.end() && *pos == id) {
+            posting.erase(pos);
+        }
+        if (posting.empty()) {
+            m_postings.erase(it);
+        }
+    }
+    doc.alive = false;
+    doc.text = std::string();
+    m_count -= 1;
+}
+
+void SearchIndex::clear() {
+    m_docs.clear();
+    m_postings.clear();
+    m_count = 0;
+}
+
+size_t SearchIndex::size() const {
+    return m_count;
+}
+
+std::vector<SearchIndex::Match> SearchIndex::search(std::string_view query) const {
+    std::vector<Match> matches;
+    auto q = normalize(query);
+
+    if (q.size() < TRIGRAM) {
+        for (DocID id = 0; id < m_docs.size(); id += 1) {
+            auto& doc = m_docs[id];
+            if (!doc.alive) {
+                continue;
+            }
+            if (q.empty()) {
+                matches.push_back(Match { id, true });
+            }
+            else if (auto prefix = findIn(doc.text, q)) {
+                matches.push_back(Match { id, *prefix });
+            }
+        }
+        return matches;
+    }
+
+    // Every matching document has all of the query's trigrams, so walk the
+    // shortest posting list and check the candidates against the others
+    std::vector<std::vector<DocID> const*> postings;
+    for (size_t i = 0; i + TRIGRAM <= q.size(); i += 1) {
+        auto it = m_postings.find(trigramAt(q, i));
+        if (it == m_postings.end()) {
+            return matches;
+        }
+        postings.push_back(&it->second);
+    }
+    std::sort(postings.begin(), postings.end(), [](auto a, auto b) {
+        return a->size() != b->size() ? a->size() < b->size() : a < b;
+    });
+    postings.erase(std::unique(postings.begin(), postings.end()), postings.end());
+
+    for (auto id : *postings.front()) {
+        auto inAll = std::all_of(postings.begin() + 1, postings.end(), [id](auto posting) {
+            return std::binary_search(posting->begin(), posting->end(), id);
+        });
+        if (!inAll) {
+            continue;
+        }
+        // Having the trigrams doesn't mean they're in the right order
+        if (auto prefix = findIn(m_docs[id].text, q)) {
+            matches.push_back(Match { id, *prefix });
+        }
+    }
+    return matches;
+}
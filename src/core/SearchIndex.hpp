@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Case-insensitive substring search over a set of short strings (item names),
+ * for filtering as the user types. Every name is broken into trigrams, and
+ * each trigram maps to the sorted list of documents containing it, so a query
+ * only has to look at the documents that have all of its trigrams instead of
+ * scanning every name. Queries shorter than a trigram just scan, which is
+ * fast enough since almost everything matches them anyway.
+ *
+ * Not thread safe
+ */
+class SearchIndex final {
+public:
+    using DocID = uint32_t;
+
+    struct Match final {
+        DocID id;
+        // Whether the query matches the start of the name or one of its words
+        bool prefix;
+    };
+
+protected:
+    struct Doc final {
+        std::string text;
+        bool alive = false;
+    };
+
+    // Indexed by DocID. IDs are never reused (until the index is cleared),
+    // so appending to the posting lists keeps them sorted
+    std::vector<Doc> m_docs;
+    std::unordered_map<uint32_t, std::vector<DocID>> m_postings;
+    size_t m_count = 0;
+
+public:
+    static std::string normalize(std::string_view text);
+
+    DocID add(std::string_view text);
+    void remove(DocID id);
+    void clear();
+    size_t size() const;
+
+    // Documents containing the query, in the order they were added. An
+    // empty query matches everything
+    std::vector<Match> search(std::string_view query) const;
+};
@@ -0,0 +1,78 @@
+#include "WorkerPool.hpp"
+#include <atomic>
+#include <memory>
+
+WorkerPool::WorkerPool() {
+    // Leave one core for the main thread
+    auto count = std::max(2u, std::thread::hardware_concurrency()) - 1;
+    for (unsigned i = 0; i < count; i += 1) {
+        m_threads.emplace_back(&WorkerPool::work, this);
+        m_threads.back().detach();
+    }
+}
+
+void WorkerPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(m_mutex);
+            m_condition.wait(lock, [this] { return !m_tasks.empty(); });
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+WorkerPool* WorkerPool::get() {
+    static auto inst = new WorkerPool();
+    return inst;
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+}
+
+void WorkerPool::parallelFor(size_t count, std::function<void(size_t)> const& func) {
+    if (count == 0) {
+        return;
+    }
+    struct State {
+        std::atomic_size_t next = 0;
+        size_t done = 0;
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
+    auto state = std::make_shared<State>();
+    // Each helper keeps taking indices until there are none left; the state 
+    // is shared since helpers that start late may outlive this call
+    auto help = [state, count, &func] {
+        size_t finished = 0;
+        for (auto i = state->next++; i < count; i = state->next++) {
+            func(i);
+            finished += 1;
+        }
+        if (finished) {
+            std::lock_guard lock(state->mutex);
+            state->done += finished;
+            if (state->done == count) {
+                state->condition.notify_all();
+            }
+        }
+    };
+    auto helpers = std::min(count - 1, m_threads.size());
+    for (size_t i = 0; i < helpers; i += 1) {
+        this->submit(help);
+    }
+    help();
+    std::unique_lock lock(state->mutex);
+    state->condition.wait(lock, [&] { return state->done == count; });
+}
+
+size_t WorkerPool::getThreadCount() const {
+    return m_threads.size();
+}
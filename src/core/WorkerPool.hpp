@@ -0,0 +1,34 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+/**
+ * A fixed pool of background threads for BetterSave's file work (parsing, 
+ * encoding, writing). Tasks must not touch Cocos objects; hand results back 
+ * with queueInMainThread
+ */
+class WorkerPool final {
+protected:
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+
+    WorkerPool();
+    void work();
+
+public:
+    static WorkerPool* get();
+
+    void submit(std::function<void()> task);
+    // Call `func` for every index in [0, count) spread over the pool, and 
+    // block until all are done. The calling thread helps out, so this is 
+    // safe to call from a worker too
+    void parallelFor(size_t count, std::function<void(size_t)> const& func);
+    size_t getThreadCount() const;
+};
@@ -0,0 +1,100 @@
+#include "Bench.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <numeric>
+
+#ifdef _WIN32
+    #include <Windows.h>
+    #include <Psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+double BenchResult::percentile(double p) const {
+    if (samples.empty()) {
+        return 0;
+    }
+    auto sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    auto index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+double BenchResult::total() const {
+    return std::accumulate(samples.begin(), samples.end(), 0.0);
+}
+
+BenchResult runBench(
+    std::string const& name, size_t iterations, std::function<void()> const& func,
+    size_t itemsPerSample, size_t bytesPerSample, bool warmup
+) {
+    BenchResult result;
+    result.name = name;
+    result.itemsPerSample = itemsPerSample;
+    result.bytesPerSample = bytesPerSample;
+    if (warmup) {
+        func();
+    }
+    result.samples.reserve(iterations);
+    for (size_t i = 0; i < iterations; i += 1) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto time = std::chrono::steady_clock::now() - start;
+        result.samples.push_back(std::chrono::duration<double, std::milli>(time).count());
+    }
+    return result;
+}
+
+void printBenchHeader() {
+    std::printf(
+        "%-44s %8s %10s %10s %10s %10s %14s %12s\n",
+        "benchmark", "runs", "p50 ms", "p90 ms", "p99 ms", "max ms", "items/s", "MB/s"
+    );
+}
+
+void printBenchResult(BenchResult const& result) {
+    auto seconds = result.total() / 1000.0;
+    auto count = result.samples.size();
+    auto itemsPerSec = seconds > 0 ? count * result.itemsPerSample / seconds : 0;
+    auto mbPerSec = seconds > 0 ? count * result.bytesPerSample / seconds / (1024.0 * 1024.0) : 0;
+    std::printf(
+        "%-44s %8zu %10.3f %10.3f %10.3f %10.3f %14.0f %12.1f\n",
+        result.name.c_str(), count,
+        result.percentile(50), result.percentile(90), result.percentile(99), result.percentile(100),
+        itemsPerSec, mbPerSec
+    );
+    std::fflush(stdout);
+}
+
+size_t getPeakRSS() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    #ifdef __APPLE__
+        return usage.ru_maxrss;
+    #else
+        return usage.ru_maxrss * 1024;
+    #endif
+#endif
+}
+
+std::string formatBytes(double bytes) {
+    char buf[32];
+    if (bytes >= 1024 * 1024 * 1024) {
+        std::snprintf(buf, sizeof(buf), "%.2f GiB", bytes / (1024.0 * 1024 * 1024));
+    }
+    else if (bytes >= 1024 * 1024) {
+        std::snprintf(buf, sizeof(buf), "%.1f MiB", bytes / (1024.0 * 1024));
+    }
+    else {
+        std::snprintf(buf, sizeof(buf), "%.1f KiB", bytes / 1024.0);
+    }
+    return buf;
+}
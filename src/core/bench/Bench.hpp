@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+
+// Timings of one benchmark
+struct BenchResult final {
+    std::string name;
+    std::vector<double> samples;
+    // How many items / bytes a single sample processes, for throughput
+    size_t itemsPerSample = 1;
+    size_t bytesPerSample = 0;
+
+    double percentile(double p) const;
+    double total() const;
+};
+
+/**
+ * Run `func` `iterations` times, timing each call separately. The first call 
+ * is not counted if `warmup` is set
+ */
+BenchResult runBench(
+    std::string const& name, size_t iterations, std::function<void()> const& func,
+    size_t itemsPerSample = 1, size_t bytesPerSample = 0, bool warmup = false
+);
+void printBenchHeader();
+void printBenchResult(BenchResult const& result);
+
+// Peak resident set size of this process in bytes
+size_t getPeakRSS();
+std::string formatBytes(double bytes);
@@ -0,0 +1,73 @@
+#include "Corpus.hpp"
+#include <fstream>
+
+static constexpr char BASE64_CHARS[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+Corpus::Corpus(uint64_t seed) : m_rng(seed) {}
+
+std::string Corpus::base64(size_t size) {
+    std::string res;
+    res.resize(size);
+    for (size_t i = 0; i < size; i += 8) {
+        auto bits = m_rng();
+        for (size_t j = i; j < std::min(i + 8, size); j += 1) {
+            res[j] = BASE64_CHARS[bits & 63];
+            bits >>= 8;
+        }
+    }
+    return res;
+}
+
+std::string Corpus::levelString(size_t objects) {
+    std::string res = "kS38,1_0_2_102_3_255_11_255_12_255_13_255_4_-1_6_1000_7_1_15_1_18_0_8_1|,kA13,0,kA15,0,kA16,0,kA14,,kA6,0,kA7,0;";
+    res.reserve(res.size() + objects * 24);
+    std::uniform_int_distribution<int> ids(1, 1900);
+    std::uniform_int_distribution<int> pos(0, 30000);
+    for (size_t i = 0; i < objects; i += 1) {
+        res += "1," + std::to_string(ids(m_rng));
+        res += ",2," + std::to_string(pos(m_rng));
+        res += ",3," + std::to_string(pos(m_rng) / 10);
+        res += ';';
+    }
+    return res;
+}
+
+std::string Corpus::gmdPlist(std::string const& name, int revision, size_t objects, size_t levelStringSize) {
+    std::string res = R"(<?xml version="1.0"?><plist version="1.0" gjver="2.0"><dict><k>kCEK</k><i>4</i>)";
+    res += "<k>k2</k><s>" + name + "</s>";
+    res += "<k>k4</k><s>H4sIAAAAAAAAC" + this->base64(levelStringSize) + "</s>";
+    res += "<k>k5</k><s>Player</s><k>k13</k><t /><k>k21</k><i>2</i><k>k16</k><i>1</i>";
+    res += "<k>k80</k><i>" + std::to_string(objects / 10) + "</i>";
+    res += "<k>k50</k><i>45</i><k>k47</k><t />";
+    res += "<k>k48</k><i>" + std::to_string(objects) + "</i>";
+    res += "<k>k23</k><i>2</i>";
+    res += "<k>k46</k><i>" + std::to_string(revision) + "</i>";
+    res += "<k>kI1</k><r>0</r><k>kI2</k><r>0</r><k>kI3</k><r>1</r></dict></plist>";
+    return res;
+}
+
+std::string Corpus::localLevelsPlist(std::vector<std::string> const& levelStrings) {
+    std::string res = R"(<?xml version="1.0"?><plist version="1.0" gjver="2.0"><dict><k>LLM_01</k><d><k>_isArr</k><t />)";
+    for (size_t i = 0; i < levelStrings.size(); i += 1) {
+        res += "<k>k_" + std::to_string(i) + "</k><d><k>kCEK</k><i>4</i>";
+        res += "<k>k2</k><s>Level " + std::to_string(i) + "</s>";
+        res += "<k>k4</k><s>" + levelStrings[i] + "</s>";
+        res += "<k>k46</k><i>" + std::to_string(i % 7) + "</i></d>";
+    }
+    res += "</d><k>LLM_02</k><i>37</i></dict></plist>";
+    return res;
+}
+
+std::vector<std::filesystem::path> Corpus::writeTrash(std::filesystem::path const& dir, size_t count, size_t levelStringSize) {
+    std::filesystem::create_directories(dir);
+    std::vector<std::filesystem::path> files;
+    files.reserve(count);
+    std::uniform_int_distribution<size_t> sizes(levelStringSize / 2, levelStringSize * 3 / 2);
+    for (size_t i = 0; i < count; i += 1) {
+        auto path = dir / ("level-" + std::to_string(i) + ".gmd");
+        std::ofstream(path, std::ios::binary) << this->gmdPlist("Level " + std::to_string(i), i % 5, 1000 + i, sizes(m_rng));
+        files.push_back(path);
+    }
+    return files;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+// Synthetic save data for the benchmarks. Level data is random, so it 
+// compresses worse than real levels do; sizes are what matter here
+class Corpus final {
+protected:
+    std::mt19937_64 m_rng;
+
+public:
+    Corpus(uint64_t seed = 0x6265747465727361);
+
+    // Random text that looks like a compressed level string
+    std::string base64(size_t size);
+    // An uncompressed level string with the given number of objects
+    std::string levelString(size_t objects);
+    // A level's plist as exported to .gmd, with a level string of the given size
+    std::string gmdPlist(std::string const& name, int revision, size_t objects, size_t levelStringSize);
+    // The plist of CCLocalLevels.dat with the given levels
+    std::string localLevelsPlist(std::vector<std::string> const& levelStrings);
+
+    // Write `count` trashed level files into `dir`
+    std::vector<std::filesystem::path> writeTrash(std::filesystem::path const& dir, size_t count, size_t levelStringSize);
+};
@@ -0,0 +1,343 @@
+#include "Bench.hpp"
+#include "Corpus.hpp"
+#include <Filenames.hpp>
+#include <GmdReader.hpp>
+#include <GmdWriter.hpp>
+#include <Dedup.hpp>
+#include <LevelStats.hpp>
+#include <SaveEncoder.hpp>
+#include <WorkerPool.hpp>
+#include <zlib.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+// Headless benchmarks for BetterSave's hot paths, run against synthetic data.
+// Pass --quick for smaller corpora, or a substring to only run the suites
+// whose name contains it
+
+struct Options final {
+    bool quick = false;
+    std::string filter;
+    std::filesystem::path dir;
+
+    size_t scale(size_t full, size_t quick) const {
+        return this->quick ? quick : full;
+    }
+    bool enabled(char const* suite) const {
+        return filter.empty() || std::string_view(suite).find(filter) != std::string_view::npos;
+    }
+};
+
+static void suiteHeader(char const* name) {
+    std::printf("\n== %s\n", name);
+    printBenchHeader();
+}
+
+static void benchFilenames(Options const& opts) {
+    suiteHeader("filenames");
+
+    std::vector<std::string> names;
+    Corpus corpus;
+    for (size_t i = 0; i < 1000; i += 1) {
+        names.push_back("My Cool LEVEL_" + corpus.base64(8) + " v" + std::to_string(i));
+    }
+    printBenchResult(runBench("convertToKebabCase (1k names)", opts.scale(200, 20), [&] {
+        for (auto& name : names) {
+            auto res = convertToKebabCase(name);
+            if (res.empty()) std::abort();
+        }
+    }, names.size()));
+
+    // Trashing many levels with the same name, creating each file like the
+    // trash would
+    auto count = opts.scale(2000, 300);
+    auto registryDir = opts.dir / "ids-registry";
+    std::filesystem::create_directories(registryDir);
+    NameRegistry registry;
+    printBenchResult(runBench("NameRegistry::getFreeID (same name)", count, [&] {
+        auto id = registry.getFreeID("Unnamed 0", registryDir, "gmd");
+        std::ofstream(registryDir / id);
+    }));
+
+    // The old approach that stats every candidate, for comparison
+    auto probeDir = opts.dir / "ids-probe";
+    std::filesystem::create_directories(probeDir);
+    printBenchResult(runBench("exists() probe loop (same name)", count, [&] {
+        auto id = std::string("unnamed-0.gmd");
+        size_t counter = 0;
+        while (std::filesystem::exists(probeDir / id)) {
+            id = "unnamed-0-" + std::to_string(counter++) + ".gmd";
+        }
+        std::ofstream(probeDir / id);
+    }));
+}
+
+static void benchGmdReader(Options const& opts) {
+    suiteHeader("gmd metadata");
+
+    Corpus corpus;
+    auto trashSize = opts.scale(5000, 500);
+    auto files = corpus.writeTrash(opts.dir / "trash", trashSize, 24 * 1024);
+    size_t totalBytes = 0;
+    for (auto& file : files) {
+        totalBytes += std::filesystem::file_size(file);
+    }
+
+    // What loading an unindexed trash does
+    printBenchResult(runBench("readGmdMetadata (" + std::to_string(trashSize) + " files, 1 thread)", opts.scale(5, 2), [&] {
+        for (auto& file : files) {
+            if (!readGmdMetadata(file)) std::abort();
+        }
+    }, files.size(), totalBytes));
+    printBenchResult(runBench("readGmdMetadata (" + std::to_string(trashSize) + " files, pool)", opts.scale(5, 2), [&] {
+        std::atomic_size_t read = 0;
+        WorkerPool::get()->parallelFor(files.size(), [&](size_t i) {
+            if (readGmdMetadata(files[i])) read += 1;
+        });
+        if (read != files.size()) std::abort();
+    }, files.size(), totalBytes));
+
+    // A single huge level, where the reader should skip the level string
+    auto bigPath = opts.dir / "big.gmd";
+    std::ofstream(bigPath, std::ios::binary) << corpus.gmdPlist("Big Level", 3, 100000, 3 * 1024 * 1024);
+    auto bigSize = std::filesystem::file_size(bigPath);
+    printBenchResult(runBench("readGmdMetadata (100k-object level)", opts.scale(200, 20), [&] {
+        auto meta = readGmdMetadata(bigPath);
+        if (!meta || meta->objectCount != 100000) std::abort();
+    }, 1, bigSize));
+
+    // Trashing a level: the main thread encodes the level with a placeholder 
+    // for its level string, which costs about one copy of the level string, 
+    // and the pool splices the level string into the file
+    auto levelString = "H4sIAAAAAAAAC" + corpus.base64(3 * 1024 * 1024);
+    auto header = corpus.gmdPlist("Big Level", 3, 100000, 0);
+    auto placeholder = header.find("<k>k4</k><s>") + 12;
+    header.replace(placeholder, header.find("</s>", placeholder) - placeholder, "BetterSaveLevelStringPlaceholder");
+    printBenchResult(runBench("copy 3 MB level string (main thread)", opts.scale(200, 20), [&] {
+        std::string copy = levelString;
+        if (copy.size() != levelString.size()) std::abort();
+    }, 1, levelString.size()));
+    auto splicedPath = opts.dir / "spliced.gmd";
+    printBenchResult(runBench("writeSplicedPlist (3 MB level string)", opts.scale(200, 20), [&] {
+        if (!writeSplicedPlist(splicedPath, header, "BetterSaveLevelStringPlaceholder", levelString)) std::abort();
+    }, 1, levelString.size()));
+}
+
+static void benchDedup(Options const& opts) {
+    suiteHeader("recovery dedup & order");
+
+    Corpus corpus;
+    auto levelCount = opts.scale(1000, 200);
+    // Level strings as GD stores them: gzip + base64, so they all start the
+    // same. These are also all the same size and share a long prefix, like 
+    // saves of the same level do, so only their later bytes tell them apart
+    auto const prefix = "H4sIAAAAAAAAC" + corpus.base64(8 * 1024);
+    auto const makeLevelString = [&] {
+        return prefix + corpus.base64(24 * 1024);
+    };
+    std::vector<std::string> existing;
+    for (size_t i = 0; i < levelCount; i += 1) {
+        existing.push_back(makeLevelString());
+    }
+    // Half of the recovered levels are duplicates
+    std::vector<std::string> recovered;
+    for (size_t i = 0; i < levelCount; i += 1) {
+        recovered.push_back(i % 2 ? existing[i] : makeLevelString());
+    }
+    auto contentOf = [](std::string const* str) { return std::string_view(*str); };
+
+    // Both of these go through recovery like it works: every recovered level
+    // is checked against the local levels, and added to them if it's new
+    printBenchResult(runBench("ContentIndex (" + std::to_string(levelCount) + " x " + std::to_string(levelCount) + ")", opts.scale(10, 3), [&] {
+        ContentIndex<std::string const*> index(contentOf);
+        index.reserve(existing.size() + recovered.size());
+        for (auto& level : existing) {
+            index.add(&level);
+        }
+        size_t dupes = 0;
+        for (auto& level : recovered) {
+            if (index.findDuplicate(&level)) {
+                dupes += 1;
+            }
+            else {
+                index.add(&level);
+            }
+        }
+        if (dupes != levelCount / 2) std::abort();
+    }, levelCount));
+
+    // What recovery did before ContentIndex: compare against every local
+    // level in turn
+    printBenchResult(runBench("linear scan (" + std::to_string(levelCount) + " x " + std::to_string(levelCount) + ")", opts.scale(10, 3), [&] {
+        std::vector<std::string const*> localLevels;
+        localLevels.reserve(existing.size() + recovered.size());
+        for (auto& level : existing) {
+            localLevels.push_back(&level);
+        }
+        size_t dupes = 0;
+        for (auto& level : recovered) {
+            auto found = std::find_if(localLevels.begin(), localLevels.end(), [&](auto other) {
+                return *other == level;
+            });
+            if (found != localLevels.end()) {
+                dupes += 1;
+            }
+            else {
+                localLevels.push_back(&level);
+            }
+        }
+        if (dupes != levelCount / 2) std::abort();
+    }, levelCount));
+
+    auto idCount = opts.scale(10000, 1000);
+    std::vector<std::string> ids;
+    for (size_t i = 0; i < idCount; i += 1) {
+        ids.push_back("level-" + std::to_string(i));
+    }
+    auto order = ids;
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(1));
+    printBenchResult(runBench("orderByRank (" + std::to_string(idCount) + " ids)", opts.scale(50, 10), [&] {
+        auto res = orderByRank(ids, order);
+        if (res.size() != ids.size()) std::abort();
+    }, idCount));
+}
+
+// What GD does: gzip the whole plist on one thread, then URL-safe base64 it
+// and XOR the result, the same output format as SaveEncoder
+static std::string encodeSingleThreaded(std::string const& plist, uint8_t xorKey) {
+    z_stream stream {};
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+    std::string gzip(deflateBound(&stream, plist.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(plist.data()));
+    stream.avail_in = static_cast<uInt>(plist.size());
+    stream.next_out = reinterpret_cast<Bytef*>(gzip.data());
+    stream.avail_out = static_cast<uInt>(gzip.size());
+    deflate(&stream, Z_FINISH);
+    gzip.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    static constexpr char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    std::string out;
+    out.reserve((gzip.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < gzip.size(); i += 3) {
+        uint32_t bits = static_cast<uint8_t>(gzip[i]) << 16;
+        if (i + 1 < gzip.size()) bits |= static_cast<uint8_t>(gzip[i + 1]) << 8;
+        if (i + 2 < gzip.size()) bits |= static_cast<uint8_t>(gzip[i + 2]);
+        out += ALPHABET[bits >> 18 & 63];
+        out += ALPHABET[bits >> 12 & 63];
+        out += i + 1 < gzip.size() ? ALPHABET[bits >> 6 & 63] : '=';
+        out += i + 2 < gzip.size() ? ALPHABET[bits & 63] : '=';
+    }
+    for (auto& c : out) {
+        c ^= xorKey;
+    }
+    return out;
+}
+
+static void benchSaveEncoder(Options const& opts) {
+    suiteHeader("local levels save");
+
+    Corpus corpus;
+    auto levelCount = opts.scale(1000, 100);
+    std::vector<std::string> levels;
+    for (size_t i = 0; i < levelCount; i += 1) {
+        // Local levels keep their level strings compressed, so these are
+        // mostly incompressible, with a few bigger ones
+        levels.push_back(corpus.base64(i % 50 == 0 ? 512 * 1024 : 16 * 1024));
+    }
+    // Built up front so only the encoding is timed. Encoding `plist` and
+    // `changed` in turn leaves nothing cached for either, while `plist` and
+    // `oneChanged` only differ by one level
+    auto plist = corpus.localLevelsPlist(levels);
+    auto oneChanged = plist;
+    auto changed = plist;
+    {
+        auto copy = levels;
+        copy[levelCount / 2][0] = copy[levelCount / 2][0] == 'A' ? 'B' : 'A';
+        oneChanged = corpus.localLevelsPlist(copy);
+        for (auto& level : copy) {
+            level[0] = level[0] == 'A' ? 'B' : 'A';
+        }
+        changed = corpus.localLevelsPlist(copy);
+    }
+    std::printf("(plist is %s, %zu threads)\n", formatBytes(plist.size()).c_str(), WorkerPool::get()->getThreadCount() + 1);
+
+    printBenchResult(runBench("gzip + base64 (1 thread)", opts.scale(5, 2), [&] {
+        auto res = encodeSingleThreaded(plist, 11);
+        if (res.empty()) std::abort();
+    }, levelCount, plist.size()));
+
+    bool flip = false;
+    printBenchResult(runBench("SaveEncoder (cold)", opts.scale(5, 2), [&] {
+        flip = !flip;
+        auto res = SaveEncoder::get()->encode(flip ? changed : plist, 11);
+        if (res.empty()) std::abort();
+    }, levelCount, plist.size(), true));
+
+    printBenchResult(runBench("SaveEncoder (one level changed)", opts.scale(10, 3), [&] {
+        flip = !flip;
+        auto res = SaveEncoder::get()->encode(flip ? oneChanged : plist, 11);
+        if (res.empty()) std::abort();
+    }, levelCount, plist.size(), true));
+}
+
+static void benchLevelStats(Options const& opts) {
+    suiteHeader("level stats");
+
+    // Sanity checks: GD writes the object ID first, but that isn't required
+    auto reordered = analyzeLevelString("kS38,x;1,1,2,0;2,0,1,5,57,3.4;1,1;");
+    if (reordered.objectCount != 3 || reordered.groupCount != 2 || reordered.groupedObjects != 1) {
+        std::printf("analyzeLevelString miscounted objects with the ID not first\n");
+        std::abort();
+    }
+
+    Corpus corpus;
+    auto objects = opts.scale(500000, 50000);
+    auto levelString = corpus.levelString(objects);
+    std::printf("(level string is %s)\n", formatBytes(levelString.size()).c_str());
+
+    printBenchResult(runBench("analyzeLevelString", opts.scale(50, 10), [&] {
+        auto stats = analyzeLevelString(levelString);
+        if (stats.objectCount != objects) std::abort();
+    }, objects, levelString.size()));
+
+    // Just finding the objects, which is as fast as the analysis could go
+    printBenchResult(runBench("memchr ';' (baseline)", opts.scale(50, 10), [&] {
+        size_t count = 0;
+        auto data = static_cast<char const*>(levelString.data());
+        auto end = data + levelString.size();
+        while (auto found = static_cast<char const*>(std::memchr(data, ';', end - data))) {
+            count += 1;
+            data = found + 1;
+        }
+        if (count != objects + 1) std::abort();
+    }, objects, levelString.size()));
+}
+
+int main(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; i += 1) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            opts.quick = true;
+        }
+        else {
+            opts.filter = argv[i];
+        }
+    }
+    opts.dir = std::filesystem::temp_directory_path() / "bettersave-bench";
+    std::error_code ec;
+    std::filesystem::remove_all(opts.dir, ec);
+    std::filesystem::create_directories(opts.dir);
+
+    if (opts.enabled("filenames")) benchFilenames(opts);
+    if (opts.enabled("gmd")) benchGmdReader(opts);
+    if (opts.enabled("dedup")) benchDedup(opts);
+    if (opts.enabled("save")) benchSaveEncoder(opts);
+    if (opts.enabled("stats")) benchLevelStats(opts);
+
+    std::printf("\npeak RSS: %s\n", formatBytes(getPeakRSS()).c_str());
+    std::filesystem::remove_all(opts.dir, ec);
+    return 0;
+}